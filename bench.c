@@ -0,0 +1,513 @@
+// bench.c
+// Benchmark driver for the hot paths of the mini shell and cpuloadd.
+// shell.c is included directly, so run_process(), run_pipe() and the prompt renderer
+// are measured in-process; the cpuloadd sampler lives in bench_cpuloadd.c.
+//
+// Output: one JSON object per line ({"bench":..., "variant":..., metrics...}) for
+// regression tracking. Build: make bench   Run: ./bench [-s scale] [-e shell] [name ...]
+// Names: spawn, builtin, history, pipe, prompt, transport, sample (default: all)
+// -e runs the given shell binary end to end instead (batch scripts via -c); "make pgo"
+// uses it as training workload for the instrumented shell.
+
+#define CPULOAD_SHM_NAME "/cpuload-bench"
+#define CPULOAD_MQ_NAME  "/cpuload-bench"
+#define CPULOAD_SOCK_NAME "cpuload-bench"
+#define main minishell_main
+#include "shell.c"
+#undef main
+
+#include "bench.h"
+
+static double g_scale = 1.0;
+
+static long scaled(long n) {
+    long v = (long)((double)n * g_scale);
+    return v > 0 ? v : 1;
+}
+
+// ----- JSON lines -----
+static void emit_begin(const char *bench, const char *variant) {
+    printf("{\"bench\":\"%s\",\"variant\":\"%s\"", bench, variant);
+}
+
+static void emit_num(const char *key, double v) {
+    printf(",\"%s\":%.6g", key, v);
+}
+
+static void emit_end(void) {
+    printf("}\n");
+    fflush(stdout);
+}
+
+// ----- spawn: commands per second through run_process -----
+// Absolute path: a bare "true" is a builtin and would not exec at all.
+static void bench_spawn(enum spawn_engine e, long n, const char *variant) {
+    char *argv[] = { "/bin/true", NULL };
+    struct command cmd = { .argc = 1, .argv = argv, .redirs = NULL, .sched = NULL };
+
+    g_spawn_engine = e;
+    memset(g_spawn_stats, 0, sizeof(g_spawn_stats));
+    uint64_t t0 = bench_clock_ns();
+    for (long i = 0; i < n; i++) {
+        arena_reset(&g_line_arena);
+        run_process(&cmd, 0, 0, "/bin/true");
+    }
+    double sec = (double)(bench_clock_ns() - t0) / 1e9;
+
+    const struct spawn_stat *st = &g_spawn_stats[e];
+    emit_begin("spawn", variant ? variant : spawn_engine_names[e]);
+    emit_num("ops", (double)n);
+    emit_num("seconds", sec);
+    emit_num("ops_per_sec", (double)n / sec);
+    if (st->count) {
+        emit_num("spawn_avg_us", (double)st->total_ns / (double)st->count / 1e3);
+        emit_num("spawn_min_us", (double)st->min_ns / 1e3);
+        emit_num("spawn_max_us", (double)st->max_ns / 1e3);
+    }
+    emit_num("status", g_last_status);
+    emit_end();
+}
+
+// ----- builtin: echo/test through the dispatcher, in the shell and as a forked stage -----
+static void bench_builtin(long n) {
+    char *echo_argv[] = { "echo", "x", NULL };
+    char *test_argv[] = { "[", "1", "-lt", "2", "]", NULL };
+    fflush(stdout);
+    int out = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (out < 0 || devnull < 0)
+        return;
+    dup2(devnull, STDOUT_FILENO);
+
+    uint64_t t0 = bench_clock_ns();
+    for (long i = 0; i < n; i++) {
+        run_builtin(echo_argv);
+        run_builtin(test_argv);
+    }
+    fflush(stdout);
+    double sec_shell = (double)(bench_clock_ns() - t0) / 1e9;
+    int st_shell = g_last_status;
+
+    // same with the trace ring recording (two events per builtin)
+    g_trace_on = 1;
+    t0 = bench_clock_ns();
+    for (long i = 0; i < n; i++) {
+        run_builtin(echo_argv);
+        run_builtin(test_argv);
+    }
+    fflush(stdout);
+    double sec_traced = (double)(bench_clock_ns() - t0) / 1e9;
+    g_trace_on = 0;
+    g_trace_n = 0;
+
+    // stage path: fork without exec, as for "echo x | ..." or "echo x &"
+    struct command cmd = { .argc = 2, .argv = echo_argv, .redirs = NULL, .sched = NULL };
+    long forks = scaled(2000);
+    t0 = bench_clock_ns();
+    for (long i = 0; i < forks; i++) {
+        arena_reset(&g_line_arena);
+        run_process(&cmd, 0, 0, "echo x");
+    }
+    double sec_fork = (double)(bench_clock_ns() - t0) / 1e9;
+
+    dup2(out, STDOUT_FILENO);
+    close(out);
+    close(devnull);
+    emit_begin("builtin", "in_shell");
+    emit_num("ops", (double)n * 2);
+    emit_num("ns_per_op", sec_shell * 1e9 / ((double)n * 2));
+    emit_num("status", st_shell);
+    emit_end();
+    emit_begin("builtin", "in_shell_traced");
+    emit_num("ops", (double)n * 2);
+    emit_num("ns_per_op", sec_traced * 1e9 / ((double)n * 2));
+    emit_end();
+    emit_begin("builtin", "forked_stage");
+    emit_num("ops", (double)forks);
+    emit_num("ops_per_sec", (double)forks / sec_fork);
+    emit_num("status", g_last_status);
+    emit_end();
+}
+
+// ----- history: reverse search over a full ring (100k+ lines) -----
+static void bench_history_search(const char *variant, const char *q, long n) {
+    uint64_t t0 = bench_clock_ns();
+    long hits = 0;
+    for (long i = 0; i < n; i++)
+        hits += hist_search(q, strlen(q), (long)g_hist.seq - 1) >= 0;
+    double ns = (double)(bench_clock_ns() - t0) / (double)n;
+    emit_begin("history", variant);
+    emit_num("entries", g_hist.n);
+    emit_num("ops", (double)n);
+    emit_num("ns_per_op", ns);
+    emit_num("hits", (double)hits);
+    emit_end();
+}
+
+static void bench_history(long n) {
+    if (hist_init_mem() != 0)
+        return;
+    char line[128];
+    uint64_t t0 = bench_clock_ns();
+    for (uint32_t i = 0; i < HIST_MAX; i++) {
+        // varied pipelines; exactly one line mentions "deploy-canary"
+        int len = snprintf(line, sizeof(line), "%s /var/log/app%u.log | grep -c err%u | sort",
+                           i == 1000 ? "deploy-canary" : (i % 3 ? "cat" : "tail -n 100"),
+                           i % 977, i % 131);
+        hist_add_mem(line, (size_t)len);
+    }
+    double fill = (double)(bench_clock_ns() - t0) / 1e6;
+    emit_begin("history", "fill");
+    emit_num("entries", g_hist.n);
+    emit_num("ms", fill);
+    emit_end();
+    // old, rare match: only the trigram candidates are compared
+    bench_history_search("rare_trigram", "deploy-can", n);
+    // no match at all, short query: linear scan over the whole ring
+    bench_history_search("miss_short", "zq", n / 100 > 0 ? n / 100 : 1);
+    // frequent match near the newest entry
+    bench_history_search("recent_trigram", "app976.log", n);
+}
+
+// ----- pipe: MB/s through a two-stage run_pipe -----
+static void bench_pipe(const char *path, size_t bytes, int pipe_size, long n) {
+    char line[PATH_MAX + 64];
+    g_pipe_size = pipe_size;
+    g_spawn_engine = SPAWN_POSIX;
+    uint64_t t0 = bench_clock_ns();
+    for (long i = 0; i < n; i++) {
+        arena_reset(&g_line_arena);
+        snprintf(line, sizeof(line), "cat %s | cat > /dev/null", path);
+        char *text = arena_strdup(&g_line_arena, line);
+        struct pipeline *pl = parse_command(line, text, &g_line_arena);
+        if (pl)
+            run_pipe(pl);
+    }
+    double sec = (double)(bench_clock_ns() - t0) / 1e9;
+    g_pipe_size = 0;
+
+    char variant[32];
+    snprintf(variant, sizeof(variant), pipe_size ? "pipesz_%dk" : "pipesz_default", pipe_size / 1024);
+    emit_begin("pipe", variant);
+    emit_num("ops", (double)n);
+    emit_num("bytes", (double)bytes * (double)n);
+    emit_num("seconds", sec);
+    emit_num("mb_per_sec", (double)bytes * (double)n / sec / (1024.0 * 1024.0));
+    emit_num("status", g_last_status);
+    emit_end();
+}
+
+static void bench_pipe_all(void) {
+    size_t bytes = (size_t)scaled(64) << 20;
+    char path[] = "/tmp/minishell-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return;
+    }
+    static char chunk[1 << 20];
+    memset(chunk, 'x', sizeof(chunk));
+    for (size_t done = 0; done < bytes; done += sizeof(chunk))
+        if (write(fd, chunk, sizeof(chunk)) != (ssize_t)sizeof(chunk)) {
+            perror("write");
+            break;
+        }
+    close(fd);
+    bench_pipe(path, bytes, 0, 3);
+    bench_pipe(path, bytes, 1 << 20, 3);
+    unlink(path);
+}
+
+// ----- prompt: latency (stdout -> /dev/null), cached and forced re-render -----
+static void bench_prompt(const char *variant, long n, int cached) {
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int saved = dup(STDOUT_FILENO);
+    fflush(stdout);
+    dup2(devnull, STDOUT_FILENO);
+    uint64_t t0 = bench_clock_ns();
+    for (long i = 0; i < n; i++) {
+        if (!cached) g_prompt_valid = 0;
+        prompt_print();
+    }
+    uint64_t dt = bench_clock_ns() - t0;
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(devnull);
+
+    emit_begin("prompt", variant);
+    emit_num("ops", (double)n);
+    emit_num("ns_per_op", (double)dt / (double)n);
+    emit_end();
+}
+
+static void bench_prompt_all(struct cpuload_shm *writer) {
+    long n = scaled(200000);
+    if (g_ps_n == 0) {
+        cwd_init();
+        prompt_parse(PROMPT_DEFAULT);
+    }
+    // no cpuloadd: no attach attempts while measuring
+    cpu_shm_detach();
+    g_cpu_push_valid = 0;
+    g_cpu_shm_retry = time(NULL) + 3600;
+    bench_prompt("no_load", n, 1);
+
+    // Socket/MQ: the last received record, already decoded
+    memset(&g_cpu_push, 0, sizeof(g_cpu_push));
+    g_cpu_push.timestamp_ns = realtime_ns();
+    g_cpu_push.interval_ms = 1000;
+    g_cpu_push.load = 42.0f;
+    g_cpu_push_valid = 1;
+    bench_prompt("pushed", n, 1);
+    g_cpu_push_valid = 0;
+
+    if (writer && cpu_shm_attach() == 0) {
+        bench_prompt("shm", n, 1);
+        bench_prompt("shm_render", n, 0);
+        cpu_shm_detach();
+    }
+}
+
+// ----- transport: publish + read of one sample, shm seqlock vs POSIX MQ -----
+static void bench_transport(struct cpuload_shm *writer) {
+    long n = scaled(1000000);
+    if (writer && cpu_shm_attach() == 0) {
+        static struct cpuload_sample src, dst;
+        src.interval_ms = 1000;
+        uint64_t t0 = bench_clock_ns();
+        for (long i = 0; i < n; i++) {
+            src.load = (float)(i % 100);
+            src.timestamp_ns = (uint64_t)i;
+            cpuload_publish(writer, &src);
+            cpuload_read(g_cpu_shm, &dst);
+        }
+        uint64_t dt = bench_clock_ns() - t0;
+        cpu_shm_detach();
+        emit_begin("transport", "shm");
+        emit_num("ops", (double)n);
+        emit_num("ns_per_op", (double)dt / (double)n);
+        emit_num("record_bytes", (double)sizeof(src));
+        emit_end();
+    }
+
+    struct mq_attr attr = { .mq_maxmsg = 8, .mq_msgsize = (long)CPULOAD_WIRE_MAX };
+    mq_unlink(CPULOAD_MQ_NAME);
+    mqd_t q = mq_open(CPULOAD_MQ_NAME, O_CREAT | O_RDWR | O_NONBLOCK, 0600, &attr);
+    if (q == (mqd_t)-1) {
+        perror("mq_open");
+        return;
+    }
+    g_mq = q;
+    n = scaled(200000);
+    static struct cpuload_sample src;
+    static struct cpuload_wire wire;
+    src.ncpus = 8;
+    size_t len = 0;
+    uint64_t t0 = bench_clock_ns();
+    for (long i = 0; i < n; i++) {
+        src.load = (float)(i % 100);
+        len = cpuload_wire_encode(&src, &wire);
+        mq_send(q, (const char *)&wire, len, 0);
+        mq_drain();
+    }
+    uint64_t dt = bench_clock_ns() - t0;
+    g_mq = (mqd_t)-1;
+    mq_close(q);
+    mq_unlink(CPULOAD_MQ_NAME);
+    emit_begin("transport", "mq");
+    emit_num("ops", (double)n);
+    emit_num("ns_per_op", (double)dt / (double)n);
+    emit_num("record_bytes", (double)len);
+    emit_end();
+
+    // Socket fan-out: one sendmmsg to all subscribers plus every client's recv
+    static const int nsubs[] = { 1, 8, 32 };
+    for (size_t k = 0; k < sizeof(nsubs) / sizeof(nsubs[0]); k++) {
+        n = scaled(20000);
+        double ns = bench_cpuload_fanout_ns(nsubs[k], n);
+        if (ns < 0)
+            continue;
+        emit_begin("transport", "sock");
+        emit_num("subscribers", (double)nsubs[k]);
+        emit_num("ops", (double)n);
+        emit_num("ns_per_op", ns);
+        emit_num("ns_per_client", ns / nsubs[k]);
+        emit_end();
+    }
+}
+
+// ----- sample: cost of one cpuloadd tick -----
+static void bench_sample(void) {
+    long n = scaled(20000);
+    double ns = bench_cpuload_sample_ns(n);
+    emit_begin("sample", "proc_pread");
+    emit_num("ops", (double)n);
+    emit_num("ns_per_op", ns);
+    emit_end();
+}
+
+// ----- e2e: an external shell binary driven through "-c" scripts -----
+static int run_shell(const char *shell, const char *script, const char *engine) {
+    char *argv[] = { (char *)shell, "-c", (char *)script, NULL };
+    if (engine) setenv("MINISHELL_SPAWN", engine, 1);
+    else unsetenv("MINISHELL_SPAWN");
+    pid_t pid;
+    int err = posix_spawn(&pid, shell, NULL, NULL, argv, environ);
+    unsetenv("MINISHELL_SPAWN");
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", shell, strerror(err));
+        return -1;
+    }
+    int st;
+    while (waitpid(pid, &st, 0) < 0 && errno == EINTR)
+        ;
+    return WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+}
+
+// n copies of line (including its newline) as one -c script
+static char *repeat_script(const char *line, long n) {
+    size_t l = strlen(line);
+    char *script = malloc((size_t)n * l + 1);
+    if (!script) return NULL;
+    for (long i = 0; i < n; i++)
+        memcpy(script + (size_t)i * l, line, l);
+    script[(size_t)n * l] = '\0';
+    return script;
+}
+
+static void bench_e2e_spawn(const char *shell, const char *engine, long n) {
+    char *script = repeat_script("/bin/true\n", n);
+    if (!script) return;
+    uint64_t t0 = bench_clock_ns();
+    int st = run_shell(shell, script, engine);
+    double sec = (double)(bench_clock_ns() - t0) / 1e9;
+    free(script);
+    emit_begin("e2e_spawn", engine);
+    emit_num("ops", (double)n);
+    emit_num("seconds", sec);
+    emit_num("ops_per_sec", (double)n / sec);
+    emit_num("status", st);
+    emit_end();
+}
+
+// typical script lines that never leave the shell
+static void bench_e2e_builtin(const char *shell, long n) {
+    char *script = repeat_script("echo x > /dev/null\n[ 1 -lt 2 ]\ntrue\n", n);
+    if (!script) return;
+    uint64_t t0 = bench_clock_ns();
+    int st = run_shell(shell, script, NULL);
+    double sec = (double)(bench_clock_ns() - t0) / 1e9;
+    free(script);
+    emit_begin("e2e_builtin", "echo_test_true");
+    emit_num("ops", (double)n * 3);
+    emit_num("seconds", sec);
+    emit_num("ops_per_sec", (double)n * 3 / sec);
+    emit_num("status", st);
+    emit_end();
+}
+
+static void bench_e2e(const char *shell) {
+    bench_e2e_spawn(shell, "posix", scaled(2000));
+    bench_e2e_spawn(shell, "fork", scaled(2000));
+    bench_e2e_builtin(shell, scaled(3000));   // one -c argument: stays below MAX_ARG_STRLEN
+
+    size_t bytes = (size_t)scaled(64) << 20;
+    char path[] = "/tmp/minishell-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return;
+    }
+    static char chunk[1 << 20];
+    memset(chunk, 'x', sizeof(chunk));
+    for (size_t done = 0; done < bytes; done += sizeof(chunk))
+        if (write(fd, chunk, sizeof(chunk)) != (ssize_t)sizeof(chunk)) break;
+    close(fd);
+
+    // pipeline, builtin cat, redirections and the parallel builtin in one script
+    char script[4 * PATH_MAX + 256];
+    snprintf(script, sizeof(script),
+             "cat %s | cat > /dev/null\n"
+             "pipesz 1048576\n"
+             "cat %s | cat | cat > /dev/null\n"
+             "cat %s > /dev/null\n"
+             "parallel -j 4 true <<< \"1 2 3 4 5 6 7 8\"\n"
+             "jobs\n", path, path, path);
+    uint64_t t0 = bench_clock_ns();
+    int st = run_shell(shell, script, NULL);
+    double sec = (double)(bench_clock_ns() - t0) / 1e9;
+    unlink(path);
+    emit_begin("e2e_pipe", "mixed");
+    emit_num("bytes", (double)bytes * 3);   // three passes over the file
+    emit_num("seconds", sec);
+    emit_num("mb_per_sec", (double)bytes * 3 / sec / (1024.0 * 1024.0));
+    emit_num("status", st);
+    emit_end();
+}
+
+static int selected(int argc, char **argv, int first, const char *name) {
+    if (first >= argc) return 1;
+    for (int i = first; i < argc; i++)
+        if (strcmp(argv[i], name) == 0) return 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int first = 1;
+    const char *external = NULL;
+    while (first < argc && argv[first][0] == '-') {
+        if (first + 1 == argc) {
+            g_scale = 0;        // option without a value
+        } else if (strcmp(argv[first], "-s") == 0) {
+            g_scale = strtod(argv[first + 1], NULL);
+        } else if (strcmp(argv[first], "-e") == 0) {
+            external = argv[first + 1];
+        } else {
+            g_scale = 0;
+        }
+        if (g_scale <= 0) {
+            fprintf(stderr, "usage: %s [-s scale] [-e shell] [spawn|builtin|history|pipe|prompt|transport|sample ...]\n",
+                    argv[0]);
+            return 2;
+        }
+        first += 2;
+    }
+    if (external) {
+        bench_e2e(external);
+        return 0;
+    }
+
+    // Like batch mode: no status lines, no job control, reaping via signalfd
+    g_batch = 1;
+    if (event_loop_init() != 0)
+        return 1;
+
+    struct cpuload_shm *writer = bench_cpuload_open();
+
+    if (selected(argc, argv, first, "spawn")) {
+        bench_spawn(SPAWN_POSIX, scaled(2000), NULL);
+        bench_spawn(SPAWN_FORK, scaled(2000), NULL);
+        // one cgroup v2 leaf per job (mkdir + join + rmdir), where delegated
+        if (jobcg_enable(NULL) == 0) {
+            bench_spawn(SPAWN_FORK, scaled(2000), "fork_jobcg");
+            free(g_jobcg_parent);
+            g_jobcg_parent = NULL;
+        }
+    }
+    if (selected(argc, argv, first, "builtin"))
+        bench_builtin(scaled(200000));
+    if (selected(argc, argv, first, "history"))
+        bench_history(scaled(2000));
+    if (selected(argc, argv, first, "pipe"))
+        bench_pipe_all();
+    if (selected(argc, argv, first, "prompt"))
+        bench_prompt_all(writer);
+    if (selected(argc, argv, first, "transport"))
+        bench_transport(writer);
+    if (selected(argc, argv, first, "sample"))
+        bench_sample();
+
+    bench_cpuload_close();
+    return 0;
+}
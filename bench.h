@@ -0,0 +1,23 @@
+// bench.h
+// Interface between the two halves of the benchmark driver (bench.c, bench_cpuloadd.c).
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+struct cpuload_shm;
+
+struct cpuload_shm *bench_cpuload_open(void);
+void bench_cpuload_close(void);
+double bench_cpuload_sample_ns(long iters);
+double bench_cpuload_fanout_ns(int nsubs, long iters);
+
+static inline uint64_t bench_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,102 @@
+// bench_cpuloadd.c
+// cpuloadd side of the benchmark driver (see bench.c). cpuloadd.c is included directly so
+// the real sampler is measured; main is renamed and the shm object gets its own name,
+// so a running daemon is never touched.
+
+#define CPULOAD_SHM_NAME "/cpuload-bench"
+#define MQ_NAME          "/cpuload-bench"
+#define CPULOAD_SOCK_NAME "cpuload-bench"
+#define main cpuloadd_main
+#include "cpuloadd.c"
+#undef main
+
+#include "bench.h"
+
+static struct cpuload_shm *g_bench_shm = NULL;
+
+// Creates the bench segment and publishes one real sample.
+struct cpuload_shm *bench_cpuload_open(void) {
+    if (!g_bench_shm)
+        g_bench_shm = shm_channel_open();
+    if (!g_bench_shm)
+        return NULL;
+    static struct cpuload_sample smp;
+    memset(&smp, 0, sizeof(smp));
+    cpu_sampler_prime();
+    cpu_usage_percent_delta(&smp);
+    read_loadavg(&smp);
+    read_pressure(&smp);
+    smp.timestamp_ns = realtime_ns();
+    smp.interval_ms = DEFAULT_INTERVAL_MS;
+    cpuload_publish(g_bench_shm, &smp);
+    return g_bench_shm;
+}
+
+void bench_cpuload_close(void) {
+    if (g_bench_shm) {
+        munmap(g_bench_shm, sizeof(*g_bench_shm));
+        shm_unlink(CPULOAD_SHM_NAME);
+        g_bench_shm = NULL;
+    }
+}
+
+// One full tick: /proc/stat delta, loadavg and PSI.
+double bench_cpuload_sample_ns(long iters) {
+    static struct cpuload_sample smp;
+    cpu_sampler_prime();
+    uint64_t t0 = bench_clock_ns();
+    for (long i = 0; i < iters; i++) {
+        smp.flags = 0;
+        cpu_usage_percent_delta(&smp);
+        read_loadavg(&smp);
+        read_pressure(&smp);
+    }
+    return (double)(bench_clock_ns() - t0) / (double)iters;
+}
+
+// One encoded broadcast to nsubs subscribed client sockets, including their receive + decode.
+// Returns ns per tick, or -1 if the sockets cannot be set up.
+double bench_cpuload_fanout_ns(int nsubs, long iters) {
+    static struct subscribers subs;
+    if (nsubs > CPULOAD_SOCK_MAX_SUBS || sub_open(&subs) != 0)
+        return -1;
+    int cl[CPULOAD_SOCK_MAX_SUBS];
+    struct sockaddr_un srv = { .sun_family = AF_UNIX };
+    memcpy(srv.sun_path + 1, CPULOAD_SOCK_NAME, strlen(CPULOAD_SOCK_NAME));
+    socklen_t srv_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + strlen(CPULOAD_SOCK_NAME));
+    int ok = 0;
+    for (; ok < nsubs; ok++) {
+        struct sockaddr_un self = { .sun_family = AF_UNIX };
+        cl[ok] = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (cl[ok] < 0)
+            break;
+        char req = CPULOAD_SOCK_SUBSCRIBE;
+        if (bind(cl[ok], (struct sockaddr *)&self, sizeof(sa_family_t)) != 0 ||
+            sendto(cl[ok], &req, 1, 0, (struct sockaddr *)&srv, srv_len) != 1) {
+            close(cl[ok]);
+            break;
+        }
+        sub_drain(&subs);   // the request queue is short (net.unix.max_dgram_qlen)
+    }
+    double res = -1;
+    if (ok == nsubs && subs.n == (unsigned)nsubs) {
+        static struct cpuload_sample smp, out;
+        static struct cpuload_wire w, in;
+        smp.ncpus = 8;
+        uint64_t t0 = bench_clock_ns();
+        for (long i = 0; i < iters; i++) {
+            smp.timestamp_ns = (uint64_t)i;
+            size_t len = cpuload_wire_encode(&smp, &w);
+            sub_broadcast(&subs, &w, len);
+            for (int c = 0; c < nsubs; c++) {
+                ssize_t n = recv(cl[c], &in, sizeof(in), 0);
+                if (n > 0) cpuload_wire_decode(&in, (size_t)n, &out);
+            }
+        }
+        res = (double)(bench_clock_ns() - t0) / (double)iters;
+    }
+    for (int c = 0; c < ok; c++)
+        close(cl[c]);
+    close(subs.fd);
+    return res;
+}
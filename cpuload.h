@@ -0,0 +1,228 @@
+// cpuload.h
+// Shared-memory channel between cpuloadd (single writer) and any number of readers.
+// cpuloadd publishes the newest sample into the POSIX shm object "/cpuload";
+// readers map it read-only and copy it out under a seqlock, so reading the
+// current load is a couple of memory loads and never a syscall.
+//
+// Seqlock protocol: the writer makes seq odd, updates the payload and makes seq
+// even again. A reader retries while seq is odd or changed during its copy.
+//
+// Push alternative: cpuloadd also owns the Unix datagram socket "@cpuload" (abstract
+// namespace). A client binds its own (autobind) address and sends CPULOAD_SOCK_SUBSCRIBE;
+// from the next tick on it receives every sample, sent to all subscribers with one sendmmsg.
+
+#ifndef CPULOAD_H
+#define CPULOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef CPULOAD_SHM_NAME
+#define CPULOAD_SHM_NAME "/cpuload"
+#endif
+#ifndef CPULOAD_MQ_NAME
+#define CPULOAD_MQ_NAME  "/cpuload"        // legacy POSIX message queue
+#endif
+
+#ifndef CPULOAD_SOCK_NAME
+#define CPULOAD_SOCK_NAME "cpuload"        // abstract socket name, without the leading NUL
+#endif
+
+#define CPULOAD_SOCK_SUBSCRIBE   'S'      // first byte of a client request
+#define CPULOAD_SOCK_UNSUBSCRIBE 'U'
+#define CPULOAD_SOCK_MAX_SUBS    64
+
+#define CPULOAD_SHM_MAGIC   0x4c555043u   // "CPUL"
+#define CPULOAD_SHM_VERSION 4
+#define CPULOAD_MAX_CPUS    256
+#define CPULOAD_HIST_LEN    8192          // history ring entries (10 s ticks: ~22 h, 100 ms: ~13 min)
+
+#define CPULOAD_F_SIM       0x1u          // sample comes from the simulation
+#define CPULOAD_F_LOADAVG   0x2u          // loadavg[] is valid
+#define CPULOAD_F_RUNQ      0x4u          // procs_running/procs_blocked are valid
+#define CPULOAD_F_PSI       0x8u          // psi[] is valid (kernel has /proc/pressure)
+
+enum { CPULOAD_PSI_CPU, CPULOAD_PSI_MEM, CPULOAD_PSI_IO, CPULOAD_PSI_N };
+
+// One /proc/pressure/<res> file: share of wall time some/all tasks stalled, in percent.
+struct cpuload_psi {
+    float some[3];                        // avg10, avg60, avg300
+    float full[3];                        // always 0 for cpu on most kernels
+};
+
+struct cpuload_sample {
+    uint64_t timestamp_ns;                // CLOCK_REALTIME of the sample
+    uint32_t interval_ms;                 // publish interval (for staleness checks)
+    uint32_t flags;                       // CPULOAD_F_*
+    float    load;                        // aggregate load in percent (last interval)
+    float    load_ewma[3];                // smoothed over ~1 s, 10 s, 60 s
+    uint32_t ncpus;                       // valid entries in core[]
+    float    loadavg[3];                  // 1, 5, 15 min
+    uint32_t procs_running;               // runnable tasks (includes cpuloadd)
+    uint32_t procs_blocked;               // tasks in uninterruptible I/O wait
+    struct cpuload_psi psi[CPULOAD_PSI_N];
+    float    core[CPULOAD_MAX_CPUS];      // per-core load in percent, negative = offline
+};
+
+// Compact history entry, one per tick.
+struct cpuload_hist_entry {
+    uint64_t timestamp_ns;                // CLOCK_REALTIME, end of the covered interval
+    float    load;                        // aggregate load in percent
+    float    core_max;                    // busiest core, negative if unknown
+    float    psi_cpu;                     // cpu some avg10, negative if unknown
+    uint32_t procs_running;               // 0 if unknown
+};
+
+struct cpuload_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;                         // odd while the writer is updating
+    uint32_t size;                        // sizeof(struct cpuload_shm) of the writer
+    struct cpuload_sample s;
+
+    // History ring: entry i lives in hist[i % CPULOAD_HIST_LEN]. hist_claim is bumped before
+    // a slot is overwritten, hist_head after it is complete, so readers can drop torn entries.
+    uint64_t hist_claim;
+    uint64_t hist_head;                   // number of entries ever published
+    struct cpuload_hist_entry hist[CPULOAD_HIST_LEN];
+};
+
+static inline void cpuload_publish(struct cpuload_shm *shm, const struct cpuload_sample *src) {
+    uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&shm->s, src, sizeof(*src));
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static inline void cpuload_hist_push(struct cpuload_shm *shm, const struct cpuload_hist_entry *e) {
+    uint64_t h = __atomic_load_n(&shm->hist_head, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->hist_claim, h + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&shm->hist[h % CPULOAD_HIST_LEN], e, sizeof(*e));
+    __atomic_store_n(&shm->hist_head, h + 1, __ATOMIC_RELEASE);
+}
+
+// Copies up to max of the newest history entries, oldest first. Returns the count.
+static inline size_t cpuload_hist_copy(const struct cpuload_shm *shm,
+                                       struct cpuload_hist_entry *dst, size_t max) {
+    uint64_t head = __atomic_load_n(&shm->hist_head, __ATOMIC_ACQUIRE);
+    uint64_t n = head < CPULOAD_HIST_LEN ? head : CPULOAD_HIST_LEN;
+    if (n > max) n = max;
+    uint64_t first = head - n;
+    for (uint64_t i = first; i < head; i++)
+        memcpy(&dst[i - first], (const void *)&shm->hist[i % CPULOAD_HIST_LEN], sizeof(*dst));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // Entries whose slot the writer has claimed meanwhile may be torn.
+    uint64_t claim = __atomic_load_n(&shm->hist_claim, __ATOMIC_RELAXED);
+    uint64_t valid_from = claim > CPULOAD_HIST_LEN ? claim - CPULOAD_HIST_LEN : 0;
+    if (valid_from <= first)
+        return (size_t)n;
+    if (valid_from >= head)
+        return 0;
+    memmove(dst, dst + (valid_from - first), (size_t)(head - valid_from) * sizeof(*dst));
+    return (size_t)(head - valid_from);
+}
+
+// ----- Wire format -----
+// Versioned fixed-layout record for the message transports (socket, MQ); the shm segment
+// itself holds struct cpuload_sample. Host byte order (local IPC only). Loads are fixed
+// point in 1/100 percent; only core[0..ncpus) is sent. Text is produced at display time.
+#define CPULOAD_WIRE_MAGIC   0x4c43u  // "CL"
+#define CPULOAD_WIRE_VERSION 1
+#define CPULOAD_WIRE_OFFLINE 0xffffu  // core[] value of an offline CPU
+
+struct cpuload_wire {
+    uint16_t magic;
+    uint8_t  version;
+    uint8_t  hdr_len;                     // offset of core[]; newer versions append fields before it
+                                          // and stay readable: decoders use the prefix they know
+    uint32_t flags;                       // CPULOAD_F_*
+    uint64_t timestamp_ns;                // CLOCK_REALTIME of the sample
+    uint32_t interval_ms;
+    uint16_t load;                        // aggregate, 0..10000
+    uint16_t ncpus;                       // entries in core[]
+    uint16_t load_ewma[3];
+    uint16_t psi_cpu;                     // cpu some avg10, valid with CPULOAD_F_PSI
+    uint32_t procs_running;               // valid with CPULOAD_F_RUNQ
+    uint32_t procs_blocked;
+    uint16_t core[CPULOAD_MAX_CPUS];
+};
+
+#define CPULOAD_WIRE_HDR     offsetof(struct cpuload_wire, core)
+#define CPULOAD_WIRE_MAX     sizeof(struct cpuload_wire)
+
+static inline uint16_t cpuload_fix(float pct) {
+    if (!(pct > 0.0f)) return 0;          // also NaN
+    if (pct >= 100.0f) return 10000;
+    return (uint16_t)(pct * 100.0f + 0.5f);
+}
+
+// Fills *w from *s and returns the number of bytes to send.
+static inline size_t cpuload_wire_encode(const struct cpuload_sample *s, struct cpuload_wire *w) {
+    uint32_t ncpus = s->ncpus <= CPULOAD_MAX_CPUS ? s->ncpus : CPULOAD_MAX_CPUS;
+    w->magic = CPULOAD_WIRE_MAGIC;
+    w->version = CPULOAD_WIRE_VERSION;
+    w->hdr_len = (uint8_t)CPULOAD_WIRE_HDR;
+    w->flags = s->flags;
+    w->timestamp_ns = s->timestamp_ns;
+    w->interval_ms = s->interval_ms;
+    w->load = cpuload_fix(s->load);
+    w->ncpus = (uint16_t)ncpus;
+    for (int i = 0; i < 3; i++)
+        w->load_ewma[i] = cpuload_fix(s->load_ewma[i]);
+    w->psi_cpu = cpuload_fix(s->psi[CPULOAD_PSI_CPU].some[0]);
+    w->procs_running = s->procs_running;
+    w->procs_blocked = s->procs_blocked;
+    for (uint32_t i = 0; i < ncpus; i++)
+        w->core[i] = s->core[i] < 0.0f ? CPULOAD_WIRE_OFFLINE : cpuload_fix(s->core[i]);
+    return CPULOAD_WIRE_HDR + ncpus * sizeof(uint16_t);
+}
+
+// Decodes a received record into *s (fields the wire does not carry are zeroed).
+// Records of a newer version are accepted: the fields up to CPULOAD_WIRE_HDR keep their
+// meaning, extra header bytes are skipped via hdr_len.
+// Returns 0, or -1 for a foreign, older-version or truncated record.
+static inline int cpuload_wire_decode(const void *buf, size_t len, struct cpuload_sample *s) {
+    struct cpuload_wire w;
+    if (len < CPULOAD_WIRE_HDR)
+        return -1;
+    memcpy(&w, buf, CPULOAD_WIRE_HDR);
+    if (w.magic != CPULOAD_WIRE_MAGIC || w.version < CPULOAD_WIRE_VERSION ||
+        w.hdr_len < CPULOAD_WIRE_HDR || w.ncpus > CPULOAD_MAX_CPUS ||
+        len < (size_t)w.hdr_len + w.ncpus * sizeof(uint16_t))
+        return -1;
+    memcpy(w.core, (const char *)buf + w.hdr_len, w.ncpus * sizeof(uint16_t));
+    memset(s, 0, sizeof(*s));
+    s->timestamp_ns = w.timestamp_ns;
+    s->interval_ms = w.interval_ms;
+    s->flags = w.flags & ~CPULOAD_F_LOADAVG;
+    s->load = w.load / 100.0f;
+    for (int i = 0; i < 3; i++)
+        s->load_ewma[i] = w.load_ewma[i] / 100.0f;
+    s->psi[CPULOAD_PSI_CPU].some[0] = w.psi_cpu / 100.0f;
+    s->procs_running = w.procs_running;
+    s->procs_blocked = w.procs_blocked;
+    s->ncpus = w.ncpus;
+    for (uint32_t i = 0; i < w.ncpus; i++)
+        s->core[i] = w.core[i] == CPULOAD_WIRE_OFFLINE ? -1.0f : w.core[i] / 100.0f;
+    return 0;
+}
+
+// Returns 0 with a consistent copy in *dst, -1 if the writer kept us out.
+static inline int cpuload_read(const struct cpuload_shm *shm, struct cpuload_sample *dst) {
+    for (int tries = 0; tries < 64; tries++) {
+        uint32_t s1 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1u)
+            continue;
+        memcpy(dst, (const void *)&shm->s, sizeof(*dst));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint32_t s2 = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+        if (s1 == s2)
+            return 0;
+    }
+    return -1;
+}
+
+#endif
@@ -1,11 +1,31 @@
 // cpuloadd.c
-// Reads real CPU load from /proc/stat and publishes it to POSIX MQ "/cpuload" every 10 s.
+// Reads real CPU load (aggregate and per core) from /proc/stat, plus /proc/loadavg and PSI
+// (/proc/pressure/{cpu,memory,io}), and publishes it on every tick into the shared-memory
+// seqlock channel "/cpuload" (see cpuload.h). Readers never block the daemon.
+// Clients that want every sample pushed subscribe on the datagram socket "@cpuload"
+// (CPULOAD_SOCK=0 disables it); one sendmmsg per tick reaches all of them.
+// The old POSIX MQ "/cpuload" is kept as optional legacy transport: CPULOAD_MQ=1
+// (each MQ message reaches only one reader, so it does not fan out).
+// Socket and MQ messages are the binary struct cpuload_wire (fixed point, see cpuload.h).
+// Prometheus metrics: -p [addr:]port or CPULOAD_HTTP=[addr:]port serves GET /metrics
+// (single-threaded, non-blocking; the body is rendered once per sample).
 // Fallback: if /proc/stat isn't readable or parse fails repeatedly, switch to simulation.
 //
+// Interval: CPULOAD_INTERVAL_MS=<ms> or -i <ms> (default 10000, e.g. 100 for fine resolution).
+// Each tick is a delta against the previous sample (timerfd-driven, no sleep-twice);
+// EWMA-smoothed loads over ~1 s / 10 s / 60 s are published alongside.
+//
 // Force simulation via environment: CPULOAD_SIM=1
 // Or compile-time: add -DUSE_SIMULATION
 //
-// Link: gcc -O2 -Wall -pthread cpuloadd.c -o cpuloadd -lrt
+// All /proc files are kept open and re-read with pread(); parsing uses small hand-rolled
+// scanners instead of stdio/sscanf, so a sample costs a few syscalls and no allocation.
+//
+// Logging: -l error|warn|info|debug (CPULOAD_LOG), -d <points> (CPULOAD_LOG_DELTA) logs tick
+// lines only when the load moved that much; SIGUSR1 dumps the in-memory event ring.
+// SIGINT/SIGTERM end the loop cleanly (exit status 0).
+//
+// Build: make (see Makefile), or gcc -O2 -Wall cpuloadd.c -o cpuloadd -lrt
 
 #define _GNU_SOURCE
 #include <mqueue.h>
@@ -16,11 +36,185 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cpuload.h"
 
 #ifndef MQ_NAME
-#define MQ_NAME "/cpuload"
+#define MQ_NAME CPULOAD_MQ_NAME
 #endif
 
+// ----- Logging -----
+// Levels: error < warn < info < debug (-l or CPULOAD_LOG). Errors and warnings go to stderr,
+// the rest to stdout. Tick lines are info: every 10 s by default, or change-only with -d
+// (load moved by at least that many points, at most once a second); debug logs every tick.
+// Independently, every tick and event is kept in a binary in-memory ring; SIGUSR1 dumps it
+// as text to stderr or, with CPULOAD_LOG_DUMP=<file>, appends it to that file.
+enum { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG };
+static const char *const log_level_names[] = { "error", "warn", "info", "debug" };
+static int g_log_level = LOG_INFO;
+
+static int parse_log_level(const char *s) {
+    for (int i = 0; i <= LOG_DEBUG; i++)
+        if (strcmp(s, log_level_names[i]) == 0) {
+            g_log_level = i;
+            return 0;
+        }
+    fprintf(stderr, "[cpuloadd] invalid log level '%s' (error, warn, info, debug)\n", s);
+    return -1;
+}
+
+static void log_msg(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void log_msg(int level, const char *fmt, ...) {
+    if (level > g_log_level)
+        return;
+    FILE *f = level <= LOG_WARN ? stderr : stdout;
+    va_list ap;
+    va_start(ap, fmt);
+    fputs("[cpuloadd] ", f);
+    vfprintf(f, fmt, ap);
+    fputc('\n', f);
+    va_end(ap);
+    fflush(f);
+}
+
+// At most one message per interval; the number of dropped ones is reported with the next.
+struct ratelimit {
+    uint64_t next_ms;
+    unsigned suppressed;
+};
+#define RATELIMIT_MS 10000
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t mono_ms(void) {
+    return mono_ns() / 1000000u;
+}
+
+#define log_ratelimited(rl, level, fmt, ...) do {                                  \
+        uint64_t now_ = mono_ms();                                                 \
+        if ((level) > g_log_level) break;                                          \
+        if (now_ < (rl)->next_ms) { (rl)->suppressed++; break; }                   \
+        (rl)->next_ms = now_ + RATELIMIT_MS;                                       \
+        if ((rl)->suppressed)                                                      \
+            log_msg(level, fmt " (%u similar suppressed)", __VA_ARGS__, (rl)->suppressed); \
+        else                                                                       \
+            log_msg(level, fmt, __VA_ARGS__);                                      \
+        (rl)->suppressed = 0;                                                      \
+    } while (0)
+
+// Binary event ring: 32 bytes per entry, written unconditionally (no formatting).
+#define LOG_RING_LEN 4096
+enum { LOGEV_TICK, LOGEV_MISSED, LOGEV_SIM, LOGEV_SUBS, LOGEV_MQ_ERR };
+static const char *const logev_names[] = { "tick", "missed", "sim", "subs", "mq_err" };
+
+struct log_rec {
+    uint64_t ts_ns;                         // CLOCK_REALTIME
+    uint16_t ev;                            // LOGEV_*
+    uint16_t flags;                         // CPULOAD_F_* of the sample
+    uint32_t arg;                           // ticks, subscribers, errno ...
+    float load, core_max, psi_cpu, ewma10;
+};
+
+static struct log_rec g_log_ring[LOG_RING_LEN];
+static uint64_t g_log_head;                 // records ever written
+static unsigned long g_log_suppressed;      // tick lines not printed
+
+static void log_event(uint16_t ev, uint32_t arg, uint64_t ts_ns,
+                      const struct cpuload_sample *s, float core_max) {
+    struct log_rec *r = &g_log_ring[g_log_head++ % LOG_RING_LEN];
+    r->ts_ns = ts_ns;
+    r->ev = ev;
+    r->arg = arg;
+    if (s) {
+        r->flags = (uint16_t)s->flags;
+        r->load = s->load;
+        r->core_max = core_max;
+        r->psi_cpu = (s->flags & CPULOAD_F_PSI) ? s->psi[CPULOAD_PSI_CPU].some[0] : -1.0f;
+        r->ewma10 = s->load_ewma[1];
+    } else {
+        r->flags = 0;
+        r->load = r->core_max = r->psi_cpu = r->ewma10 = -1.0f;
+    }
+}
+
+// Renders the ring, oldest first. Runs from the main loop, never in the signal handler.
+static void log_dump(void) {
+    const char *path = getenv("CPULOAD_LOG_DUMP");
+    FILE *f = stderr;
+    if (path && *path && !(f = fopen(path, "a"))) {
+        log_msg(LOG_ERROR, "log dump: %s: %s", path, strerror(errno));
+        return;
+    }
+    uint64_t n = g_log_head < LOG_RING_LEN ? g_log_head : LOG_RING_LEN;
+    fprintf(f, "[cpuloadd] log dump: %llu of %llu records, %lu tick lines suppressed\n",
+            (unsigned long long)n, (unsigned long long)g_log_head, g_log_suppressed);
+    for (uint64_t i = g_log_head - n; i < g_log_head; i++) {
+        const struct log_rec *r = &g_log_ring[i % LOG_RING_LEN];
+        time_t secs = (time_t)(r->ts_ns / 1000000000ull);
+        struct tm tm;
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", localtime_r(&secs, &tm));
+        fprintf(f, "%s.%03u %-6s %u", when, (unsigned)(r->ts_ns / 1000000u % 1000u),
+                logev_names[r->ev], r->arg);
+        if (r->load >= 0)
+            fprintf(f, " load %.1f max %.1f psi %.2f ewma10 %.1f%s", r->load, r->core_max,
+                    r->psi_cpu, r->ewma10, (r->flags & CPULOAD_F_SIM) ? " sim" : "");
+        fputc('\n', f);
+    }
+    if (f == stderr) fflush(f);
+    else fclose(f);
+}
+
+// Decides whether this tick gets an info line.
+#define LOG_EVERY_MS   10000
+#define LOG_MIN_GAP_MS 1000
+
+struct tick_log {
+    float delta;                            // change-only threshold, 0 = periodic
+    int any;                                // a tick line was printed already
+    uint64_t last_ms;
+    float last_load;
+};
+
+static int tick_log_due(struct tick_log *tl, float load, uint64_t now_ms) {
+    if (g_log_level < LOG_INFO)
+        return 0;
+    int due = g_log_level >= LOG_DEBUG || !tl->any;
+    if (!due && tl->delta > 0) {
+        float moved = load > tl->last_load ? load - tl->last_load : tl->last_load - load;
+        due = moved >= tl->delta && now_ms - tl->last_ms >= LOG_MIN_GAP_MS;
+    } else if (!due) {
+        due = now_ms - tl->last_ms >= LOG_EVERY_MS;
+    }
+    if (!due) {
+        g_log_suppressed++;
+        return 0;
+    }
+    tl->any = 1;
+    tl->last_ms = now_ms;
+    tl->last_load = load;
+    return 1;
+}
+
 // ----- Simulation -----
 static double simulated_cpu_load(void) {
     // Simple bounded random walk for smoother values.
@@ -34,47 +228,162 @@ static double simulated_cpu_load(void) {
     return v;
 }
 
+// ----- Persistent /proc readers -----
+// Each file is opened once and re-read with pread(fd, buf, n, 0): procfs regenerates the
+// content on every read at offset 0, so there is no fopen/fclose or stdio buffering per tick.
+struct procfile {
+    const char *path;
+    int fd;          // -1 = not open (yet)
+    char *buf;       // grows only if the file outgrows it, then stays
+    size_t cap;
+};
+
+// Returns the content length (buffer is NUL-terminated) or -1.
+static ssize_t procfile_read(struct procfile *pf) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (pf->fd < 0) {
+            pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+            if (pf->fd < 0) return -1;
+        }
+        if (!pf->buf) {
+            pf->cap = 4096;
+            pf->buf = malloc(pf->cap);
+            if (!pf->buf) return -1;
+        }
+        ssize_t n = pread(pf->fd, pf->buf, pf->cap - 1, 0);
+        if (n < 0) {
+            if (errno == EINTR) { attempt--; continue; }
+            close(pf->fd);   // e.g. stale fd; reopen once
+            pf->fd = -1;
+            continue;
+        }
+        if ((size_t)n == pf->cap - 1) {
+            // Possibly truncated (many cores/IRQs): grow and re-read the whole snapshot.
+            char *nb = realloc(pf->buf, pf->cap * 2);
+            if (!nb) return -1;
+            pf->buf = nb;
+            pf->cap *= 2;
+            attempt--;
+            continue;
+        }
+        pf->buf[n] = '\0';
+        return n;
+    }
+    return -1;
+}
+
+// ----- Hand-rolled scanners (no sscanf) -----
+static const char *skip_blanks(const char *p) {
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+static const char *next_line(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    return nl ? nl + 1 : end;
+}
+
+// Unsigned decimal; returns NULL if no digit follows (after blanks).
+static const char *scan_u64(const char *p, unsigned long long *v) {
+    p = skip_blanks(p);
+    if (*p < '0' || *p > '9') return NULL;
+    unsigned long long x = 0;
+    while (*p >= '0' && *p <= '9') x = x * 10 + (unsigned)(*p++ - '0');
+    *v = x;
+    return p;
+}
+
+// Non-negative fixed-point decimal as used by loadavg and PSI ("12.34").
+static const char *scan_decimal(const char *p, float *v) {
+    unsigned long long ip, fp = 0, scale = 1;
+    p = scan_u64(p, &ip);
+    if (!p) return NULL;
+    if (*p == '.') {
+        p++;
+        while (*p >= '0' && *p <= '9') {
+            if (scale < 1000000) { fp = fp * 10 + (unsigned)(*p - '0'); scale *= 10; }
+            p++;
+        }
+    }
+    *v = (float)((double)ip + (double)fp / (double)scale);
+    return p;
+}
+
+static int starts_with(const char *p, const char *end, const char *lit, size_t len) {
+    return (size_t)(end - p) >= len && memcmp(p, lit, len) == 0;
+}
+#define STARTS_WITH(p, end, lit) starts_with((p), (end), (lit), sizeof(lit) - 1)
+
 // ----- Real measurement from /proc/stat -----
-// Parse the aggregate "cpu" line. Fields: user nice system idle iowait irq softirq steal guest guest_nice
-// We use the first 8 which are stable across kernels.
+// Parse the aggregate "cpu" line and one "cpuN" line per core. Fields: user nice system idle
+// iowait irq softirq steal guest guest_nice. We use the first 8 which are stable across kernels.
+// procs_running / procs_blocked give the run-queue length in the same pass.
 struct cpu_sample {
     unsigned long long user, nice_, system, idle, iowait, irq, softirq, steal;
 };
 
-static int read_cpu_sample(struct cpu_sample *s) {
-    FILE *f = fopen("/proc/stat", "r");
-    if (!f) return -1;
-    // Read first non-empty line and ensure it starts with "cpu "
-    char line[512];
-    if (!fgets(line, sizeof(line), f)) { fclose(f); return -1; }
-    fclose(f);
-    if (strncmp(line, "cpu ", 4) != 0) return -1;
+struct stat_snapshot {
+    struct cpu_sample total;
+    struct cpu_sample core[CPULOAD_MAX_CPUS];
+    unsigned ncpus;                        // highest cpuN index + 1
+    unsigned procs_running, procs_blocked;
+    int have_runq;
+};
 
-    // Parse 8 integers
+static struct procfile g_stat = { "/proc/stat", -1, NULL, 0 };
+
+static int parse_cpu_fields(const char *p, struct cpu_sample *s) {
     // guest fields ignored
-    unsigned long long user, nice_, system, idle, iowait, irq, softirq, steal;
-    int n = sscanf(line + 4, "%llu %llu %llu %llu %llu %llu %llu %llu",
-                   &user, &nice_, &system, &idle, &iowait, &irq, &softirq, &steal);
+    unsigned long long f[8] = {0};
+    int n = 0;
+    while (n < 8) {
+        const char *q = scan_u64(p, &f[n]);
+        if (!q) break;
+        p = q;
+        n++;
+    }
     if (n < 4) return -1; // need at least total+idle
-    s->user = user; s->nice_ = nice_; s->system = system; s->idle = idle;
-    s->iowait = (n >= 5) ? iowait : 0;
-    s->irq = (n >= 6) ? irq : 0;
-    s->softirq = (n >= 7) ? softirq : 0;
-    s->steal = (n >= 8) ? steal : 0;
+    s->user = f[0]; s->nice_ = f[1]; s->system = f[2]; s->idle = f[3];
+    s->iowait = f[4]; s->irq = f[5]; s->softirq = f[6]; s->steal = f[7];
     return 0;
 }
 
-static double cpu_usage_percent_once(int delay_sec) {
-    struct cpu_sample a, b;
-    if (read_cpu_sample(&a) != 0) return -1.0;
-    sleep(delay_sec);
-    if (read_cpu_sample(&b) != 0) return -1.0;
+static int read_stat_snapshot(struct stat_snapshot *st) {
+    ssize_t len = procfile_read(&g_stat);
+    if (len < 0) return -1;
+    const char *p = g_stat.buf, *end = g_stat.buf + len;
 
-    unsigned long long idle_a = a.idle + a.iowait;
-    unsigned long long idle_b = b.idle + b.iowait;
+    int have_total = 0;
+    st->ncpus = 0;
+    st->have_runq = 0;
+    st->procs_blocked = 0;
+    for (; p < end; p = next_line(p, end)) {
+        unsigned long long v;
+        if (p[0] == 'c' && STARTS_WITH(p, end, "cpu")) {
+            if (p[3] == ' ') {
+                have_total = parse_cpu_fields(p + 4, &st->total) == 0;
+            } else {
+                const char *q = scan_u64(p + 3, &v);
+                if (q && *q == ' ' && v < CPULOAD_MAX_CPUS &&
+                    parse_cpu_fields(q, &st->core[v]) == 0 && v + 1 > st->ncpus)
+                    st->ncpus = (unsigned)v + 1;
+            }
+        } else if (p[0] == 'p' && STARTS_WITH(p, end, "procs_running ")) {
+            if (scan_u64(p + 14, &v)) { st->procs_running = (unsigned)v; st->have_runq = 1; }
+        } else if (p[0] == 'p' && STARTS_WITH(p, end, "procs_blocked ")) {
+            if (scan_u64(p + 14, &v)) st->procs_blocked = (unsigned)v;
+        }
+    }
+    return have_total ? 0 : -1;
+}
+
+// Busy share between two samples in percent; -1 if no ticks elapsed (e.g. offline core).
+static double cpu_percent(const struct cpu_sample *a, const struct cpu_sample *b) {
+    unsigned long long idle_a = a->idle + a->iowait;
+    unsigned long long idle_b = b->idle + b->iowait;
 
-    unsigned long long nonidle_a = a.user + a.nice_ + a.system + a.irq + a.softirq + a.steal;
-    unsigned long long nonidle_b = b.user + b.nice_ + b.system + b.irq + b.softirq + b.steal;
+    unsigned long long nonidle_a = a->user + a->nice_ + a->system + a->irq + a->softirq + a->steal;
+    unsigned long long nonidle_b = b->user + b->nice_ + b->system + b->irq + b->softirq + b->steal;
 
     unsigned long long total_a = idle_a + nonidle_a;
     unsigned long long total_b = idle_b + nonidle_b;
@@ -83,52 +392,826 @@ static double cpu_usage_percent_once(int delay_sec) {
     unsigned long long idled  = (idle_b  >= idle_a)  ? (idle_b  - idle_a)  : 0;
 
     if (totald == 0) return -1.0;
+    if (idled > totald) idled = totald;
 
-    double used = (double)(totald - idled);
-    double pct = 100.0 * used / (double)totald;
+    double pct = 100.0 * (double)(totald - idled) / (double)totald;
     if (pct < 0.0) pct = 0.0;
     if (pct > 100.0) pct = 100.0;
     return pct;
 }
 
-static double get_cpu_load_real_or_sim(int *using_sim, int *fail_budget, int *sample_from_sim) {
+// Continuous sampler: the previous snapshot is kept and every tick computes deltas against
+// it, so each datapoint costs one read and no interval goes unobserved.
+static struct stat_snapshot g_snap[2];   // ~16 KiB each, keep them off the stack
+static struct stat_snapshot *g_prev = &g_snap[0];
+static struct stat_snapshot *g_cur = &g_snap[1];
+static int g_have_prev = 0;
+
+// Takes the baseline snapshot; the first delta is available one tick later.
+static void cpu_sampler_prime(void) {
+    g_have_prev = read_stat_snapshot(g_prev) == 0;
+}
+
+// Fills load, per-core values and run queue of smp; returns the aggregate load or -1.
+static double cpu_usage_percent_delta(struct cpuload_sample *smp) {
+    if (read_stat_snapshot(g_cur) != 0) {
+        g_have_prev = 0;   // re-baseline once /proc/stat is readable again
+        return -1.0;
+    }
+    struct stat_snapshot *a = g_prev, *b = g_cur;
+    g_prev = b;            // swap: this snapshot is the baseline for the next tick
+    g_cur = a;
+    if (!g_have_prev) {
+        g_have_prev = 1;
+        return -1.0;
+    }
+
+    double pct = cpu_percent(&a->total, &b->total);
+    if (pct < 0.0) return -1.0;
+
+    smp->load = (float)pct;
+    smp->ncpus = b->ncpus;
+    for (unsigned i = 0; i < b->ncpus; i++)
+        smp->core[i] = (i < a->ncpus) ? (float)cpu_percent(&a->core[i], &b->core[i]) : -1.0f;
+    if (b->have_runq) {
+        smp->procs_running = b->procs_running;
+        smp->procs_blocked = b->procs_blocked;
+        smp->flags |= CPULOAD_F_RUNQ;
+    }
+    return pct;
+}
+
+// ----- Load average and pressure stall information -----
+static struct procfile g_loadavg = { "/proc/loadavg", -1, NULL, 0 };
+static struct procfile g_psi[CPULOAD_PSI_N] = {
+    { "/proc/pressure/cpu",    -1, NULL, 0 },
+    { "/proc/pressure/memory", -1, NULL, 0 },
+    { "/proc/pressure/io",     -1, NULL, 0 },
+};
+
+static void read_loadavg(struct cpuload_sample *smp) {
+    if (procfile_read(&g_loadavg) < 0) return;
+    const char *p = g_loadavg.buf;
+    for (int i = 0; i < 3; i++)
+        if (!(p = scan_decimal(p, &smp->loadavg[i]))) return;
+    smp->flags |= CPULOAD_F_LOADAVG;
+}
+
+// "some avg10=0.82 avg60=1.88 avg300=2.08 total=14922846" (+ a "full" line)
+static const char *scan_psi_avgs(const char *p, float v[3]) {
+    static const char *const keys[3] = { "avg10=", "avg60=", "avg300=" };
+    for (int i = 0; i < 3; i++) {
+        p = skip_blanks(p);
+        size_t kl = strlen(keys[i]);
+        if (strncmp(p, keys[i], kl) != 0) return NULL;
+        if (!(p = scan_decimal(p + kl, &v[i]))) return NULL;
+    }
+    return p;
+}
+
+static int read_psi_file(struct procfile *pf, struct cpuload_psi *psi) {
+    ssize_t len = procfile_read(pf);
+    if (len < 0) return -1;
+    const char *p = pf->buf, *end = pf->buf + len;
+    int got = 0;
+    for (; p < end; p = next_line(p, end)) {
+        if (STARTS_WITH(p, end, "some "))
+            got = scan_psi_avgs(p + 5, psi->some) != NULL;
+        else if (STARTS_WITH(p, end, "full "))
+            (void)scan_psi_avgs(p + 5, psi->full);
+    }
+    return got ? 0 : -1;
+}
+
+static void read_pressure(struct cpuload_sample *smp) {
+    for (int i = 0; i < CPULOAD_PSI_N; i++) {
+        // Kernels without CONFIG_PSI (or booted with psi=0) have no files: flag stays off.
+        if (read_psi_file(&g_psi[i], &smp->psi[i]) != 0)
+            return;
+    }
+    smp->flags |= CPULOAD_F_PSI;
+}
+
+static double get_cpu_load_real_or_sim(int *using_sim, int *fail_budget, struct cpuload_sample *smp) {
 #if defined(USE_SIMULATION)
     (void)fail_budget;
     *using_sim = 1;
-    if (sample_from_sim) *sample_from_sim = 1;
-    return simulated_cpu_load();
+    smp->flags |= CPULOAD_F_SIM;
+    smp->load = (float)simulated_cpu_load();
+    return smp->load;
 #else
     if (*using_sim) {
-        if (sample_from_sim) *sample_from_sim = 1;
-        return simulated_cpu_load();
+        smp->flags |= CPULOAD_F_SIM;
+        smp->load = (float)simulated_cpu_load();
+        return smp->load;
     }
-    // Try real measurement with a short baseline sleep to reduce jitter.
-    double v = cpu_usage_percent_once(1);
+    double v = cpu_usage_percent_delta(smp);
     if (v < 0.0) {
-        if (sample_from_sim) *sample_from_sim = 1;
+        smp->flags |= CPULOAD_F_SIM;
+        smp->ncpus = 0;
         if (*fail_budget > 0) (*fail_budget)--;
         if (*fail_budget == 0) {
             *using_sim = 1; // Switch to simulation permanently until restart.
         }
-        return simulated_cpu_load();
+        smp->load = (float)simulated_cpu_load();
+        return smp->load;
     }
-    if (sample_from_sim) *sample_from_sim = 0;
     // Reset failure budget on success.
     *fail_budget = 3;
     return v;
 #endif
 }
 
-int main(void) {
-    // POSIX MQ setup
-    struct mq_attr attr = {0};
-    attr.mq_flags = 0;
-    attr.mq_maxmsg = 8;
-    attr.mq_msgsize = 64;
+// ----- HTTP exporter -----
+// Optional Prometheus endpoint (-p [addr:]port or CPULOAD_HTTP). Served from the tick loop
+// with poll(): no threads, every socket non-blocking. The /metrics body is rendered once per
+// sample; a request only costs a read and one writev. Connections close after the response.
+#define HTTP_MAX_CONNS  16
+#define HTTP_REQ_MAX    2048
+#define HTTP_TIMEOUT_MS 5000                // slow or idle clients are dropped
+
+struct http_conn {
+    int fd;                                 // -1 = free slot
+    uint64_t since_ms;                      // accept time (CLOCK_MONOTONIC)
+    size_t req_len;
+    char req[HTTP_REQ_MAX];
+    char *out;                              // unsent rest of the response (rare)
+    size_t out_len, out_off;
+};
+
+struct http_server {
+    int lfd;
+    struct http_conn conn[HTTP_MAX_CONNS];
+    char *body;                             // pre-rendered /metrics body
+    size_t body_len, body_cap;
+    unsigned long requests;
+};
+
+// Counters of the daemon itself, exported next to the sample.
+struct daemon_stats {
+    uint64_t ticks, ticks_missed;
+    uint64_t sample_ns_last, sample_ns_total; // cost of reading + parsing /proc per tick
+    unsigned subscribers;
+};
+
+static int http_open(struct http_server *srv, const char *spec) {
+    memset(srv, 0, sizeof(*srv));
+    srv->lfd = -1;
+    for (int i = 0; i < HTTP_MAX_CONNS; i++)
+        srv->conn[i].fd = -1;
+
+    char host[64] = "0.0.0.0";
+    const char *colon = strrchr(spec, ':');
+    const char *port_s = spec;
+    if (colon) {
+        size_t n = (size_t)(colon - spec);
+        if (n == 0 || n >= sizeof(host)) {
+            fprintf(stderr, "[cpuloadd] invalid HTTP address '%s'\n", spec);
+            return -1;
+        }
+        memcpy(host, spec, n);
+        host[n] = '\0';
+        port_s = colon + 1;
+    }
+    char *end;
+    unsigned long port = strtoul(port_s, &end, 10);
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    if (*port_s == '\0' || *end != '\0' || port == 0 || port > 65535 ||
+        inet_pton(AF_INET, host, &sa.sin_addr) != 1) {
+        fprintf(stderr, "[cpuloadd] invalid HTTP address '%s' (expected [ipv4:]port)\n", spec);
+        return -1;
+    }
+
+    srv->lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (srv->lfd == -1) {
+        perror("socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(srv->lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(srv->lfd, (struct sockaddr *)&sa, sizeof(sa)) == -1 || listen(srv->lfd, 64) == -1) {
+        fprintf(stderr, "[cpuloadd] HTTP %s: %s\n", spec, strerror(errno));
+        close(srv->lfd);
+        srv->lfd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void http_close_conn(struct http_conn *c) {
+    close(c->fd);
+    c->fd = -1;
+    free(c->out);
+    c->out = NULL;
+    c->out_len = c->out_off = 0;
+}
+
+static void body_printf(struct http_server *srv, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void body_printf(struct http_server *srv, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        size_t room = srv->body_cap - srv->body_len;
+        int n = vsnprintf(srv->body ? srv->body + srv->body_len : NULL, room, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return;
+        if ((size_t)n < room) {
+            srv->body_len += (size_t)n;
+            return;
+        }
+        size_t cap = srv->body_cap ? srv->body_cap * 2 : 4096;
+        while (cap - srv->body_len <= (size_t)n) cap *= 2;
+        char *nb = realloc(srv->body, cap);
+        if (!nb)
+            return;
+        srv->body = nb;
+        srv->body_cap = cap;
+    }
+}
+
+#define METRIC(srv, name, type, help) \
+    body_printf(srv, "# HELP " name " " help "\n# TYPE " name " " type "\n")
+
+// Rebuilds the /metrics body (Prometheus text format 0.0.4) from the newest sample.
+static void http_render(struct http_server *srv, const struct cpuload_sample *s,
+                        const struct daemon_stats *st) {
+    static const char *const tau[3] = { "1s", "10s", "60s" };
+    static const char *const win[3] = { "10s", "60s", "300s" };
+    static const char *const res[CPULOAD_PSI_N] = { "cpu", "memory", "io" };
+    srv->body_len = 0;
+
+    METRIC(srv, "cpuload_load_percent", "gauge", "Aggregate CPU load over the last interval.");
+    body_printf(srv, "cpuload_load_percent %.2f\n", s->load);
+    METRIC(srv, "cpuload_load_ewma_percent", "gauge", "Exponentially smoothed aggregate CPU load.");
+    for (int i = 0; i < 3; i++)
+        body_printf(srv, "cpuload_load_ewma_percent{tau=\"%s\"} %.2f\n", tau[i], s->load_ewma[i]);
+    if (s->ncpus > 0) {
+        METRIC(srv, "cpuload_core_load_percent", "gauge", "Per-core CPU load over the last interval (online cores).");
+        for (uint32_t i = 0; i < s->ncpus; i++)
+            if (s->core[i] >= 0.0f)
+                body_printf(srv, "cpuload_core_load_percent{cpu=\"%u\"} %.2f\n", i, s->core[i]);
+    }
+    if (s->flags & CPULOAD_F_LOADAVG) {
+        METRIC(srv, "cpuload_loadavg", "gauge", "System load average (/proc/loadavg).");
+        static const char *const la[3] = { "1m", "5m", "15m" };
+        for (int i = 0; i < 3; i++)
+            body_printf(srv, "cpuload_loadavg{window=\"%s\"} %.2f\n", la[i], s->loadavg[i]);
+    }
+    if (s->flags & CPULOAD_F_RUNQ) {
+        METRIC(srv, "cpuload_procs_running", "gauge", "Runnable tasks.");
+        body_printf(srv, "cpuload_procs_running %u\n", s->procs_running);
+        METRIC(srv, "cpuload_procs_blocked", "gauge", "Tasks blocked on I/O.");
+        body_printf(srv, "cpuload_procs_blocked %u\n", s->procs_blocked);
+    }
+    if (s->flags & CPULOAD_F_PSI) {
+        METRIC(srv, "cpuload_pressure_percent", "gauge", "Pressure stall information (/proc/pressure).");
+        for (int r = 0; r < CPULOAD_PSI_N; r++)
+            for (int i = 0; i < 3; i++) {
+                body_printf(srv, "cpuload_pressure_percent{resource=\"%s\",kind=\"some\",window=\"%s\"} %.2f\n",
+                            res[r], win[i], s->psi[r].some[i]);
+                body_printf(srv, "cpuload_pressure_percent{resource=\"%s\",kind=\"full\",window=\"%s\"} %.2f\n",
+                            res[r], win[i], s->psi[r].full[i]);
+            }
+    }
+    METRIC(srv, "cpuload_simulated", "gauge", "1 if the sample comes from the simulation instead of /proc/stat.");
+    body_printf(srv, "cpuload_simulated %d\n", (s->flags & CPULOAD_F_SIM) ? 1 : 0);
+    METRIC(srv, "cpuload_sample_timestamp_seconds", "gauge", "Wall-clock time of the sample.");
+    body_printf(srv, "cpuload_sample_timestamp_seconds %.3f\n", (double)s->timestamp_ns / 1e9);
+    METRIC(srv, "cpuload_interval_seconds", "gauge", "Configured sampling interval.");
+    body_printf(srv, "cpuload_interval_seconds %.3f\n", s->interval_ms / 1000.0);
+    METRIC(srv, "cpuload_ticks_total", "counter", "Samples taken.");
+    body_printf(srv, "cpuload_ticks_total %llu\n", (unsigned long long)st->ticks);
+    METRIC(srv, "cpuload_ticks_missed_total", "counter", "Ticks skipped because the daemon ran late.");
+    body_printf(srv, "cpuload_ticks_missed_total %llu\n", (unsigned long long)st->ticks_missed);
+    METRIC(srv, "cpuload_sampler_seconds", "gauge", "Time spent reading /proc for the last sample.");
+    body_printf(srv, "cpuload_sampler_seconds %.9f\n", st->sample_ns_last / 1e9);
+    METRIC(srv, "cpuload_sampler_seconds_total", "counter", "Time spent reading /proc for all samples.");
+    body_printf(srv, "cpuload_sampler_seconds_total %.9f\n", st->sample_ns_total / 1e9);
+    METRIC(srv, "cpuload_subscribers", "gauge", "Clients subscribed on the push socket.");
+    body_printf(srv, "cpuload_subscribers %u\n", st->subscribers);
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        METRIC(srv, "cpuload_process_cpu_seconds_total", "counter", "CPU time used by cpuloadd.");
+        body_printf(srv, "cpuload_process_cpu_seconds_total %.6f\n",
+                    ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+                    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6);
+    }
+    METRIC(srv, "cpuload_http_requests_total", "counter", "HTTP requests answered.");
+    body_printf(srv, "cpuload_http_requests_total %lu\n", srv->requests);
+}
 
-    mqd_t q = mq_open(MQ_NAME, O_CREAT | O_WRONLY, 0666, &attr);
-    if (q == (mqd_t)-1) {
-        perror("mq_open");
+// Sends the response; what the socket does not take now is kept for POLLOUT.
+static void http_send(struct http_conn *c, const char *status, const char *type,
+                      const char *body, size_t body_len) {
+    char hdr[256];
+    int hn = snprintf(hdr, sizeof(hdr),
+                      "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                      "Connection: close\r\n\r\n", status, type, body_len);
+    struct iovec iov[2] = { { hdr, (size_t)hn }, { (void *)body, body_len } };
+    ssize_t n;
+    do {
+        n = writev(c->fd, iov, 2);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) n = (errno == EAGAIN) ? 0 : -1;
+    size_t total = (size_t)hn + body_len;
+    if (n < 0 || (size_t)n == total) {
+        http_close_conn(c);
+        return;
+    }
+    c->out = malloc(total - (size_t)n);
+    if (!c->out) {
+        http_close_conn(c);
+        return;
+    }
+    size_t off = 0;
+    for (int i = 0; i < 2; i++) {
+        size_t skip = (size_t)n > iov[i].iov_len ? iov[i].iov_len : (size_t)n;
+        memcpy(c->out + off, (char *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        off += iov[i].iov_len - skip;
+        n -= (ssize_t)skip;
+    }
+    c->out_len = off;
+    c->out_off = 0;
+}
+
+static void http_handle(struct http_server *srv, struct http_conn *c) {
+    static const char text[] = "text/plain; charset=utf-8";
+    srv->requests++;
+    if (strncmp(c->req, "GET ", 4) != 0) {
+        http_send(c, "405 Method Not Allowed", text, "GET only\n", 9);
+        return;
+    }
+    const char *path = c->req + 4;
+    size_t plen = strcspn(path, " ?\r\n");
+    if (plen == 8 && memcmp(path, "/metrics", 8) == 0)
+        http_send(c, "200 OK", "text/plain; version=0.0.4; charset=utf-8", srv->body, srv->body_len);
+    else if (plen == 1 && path[0] == '/')
+        http_send(c, "200 OK", text, "cpuloadd: see /metrics\n", 23);
+    else
+        http_send(c, "404 Not Found", text, "not found\n", 10);
+}
+
+static void http_readable(struct http_server *srv, struct http_conn *c) {
+    ssize_t n = read(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        http_close_conn(c);
+        return;
+    }
+    c->req_len += (size_t)n;
+    c->req[c->req_len] = '\0';
+    if (strstr(c->req, "\r\n\r\n") || strstr(c->req, "\n\n"))
+        http_handle(srv, c);
+    else if (c->req_len == sizeof(c->req) - 1)
+        http_send(c, "431 Request Header Fields Too Large", "text/plain", "", 0);
+}
+
+static void http_writable(struct http_conn *c) {
+    ssize_t n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n < 0 || (c->out_off += (size_t)n) == c->out_len)
+        http_close_conn(c);
+}
+
+static int http_free_slot(const struct http_server *srv) {
+    for (int i = 0; i < HTTP_MAX_CONNS; i++)
+        if (srv->conn[i].fd < 0) return i;
+    return -1;
+}
+
+// Accepts while slots are free; the rest waits in the listen backlog.
+static void http_accept(struct http_server *srv, uint64_t now) {
+    int slot;
+    while ((slot = http_free_slot(srv)) >= 0) {
+        int fd = accept4(srv->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        struct http_conn *c = &srv->conn[slot];
+        c->fd = fd;
+        c->since_ms = now;
+        c->req_len = 0;
+    }
+}
+
+// One poll round over the HTTP sockets plus wake_fd (the timerfd, -1 = none).
+// Returns 1 if wake_fd became readable.
+static int http_poll(struct http_server *srv, int wake_fd, int timeout_ms) {
+    struct pollfd pfd[2 + HTTP_MAX_CONNS];
+    int map[2 + HTTP_MAX_CONNS];
+    nfds_t n = 0;
+    if (wake_fd >= 0)
+        pfd[n++] = (struct pollfd){ .fd = wake_fd, .events = POLLIN };
+    if (http_free_slot(srv) >= 0) {
+        pfd[n] = (struct pollfd){ .fd = srv->lfd, .events = POLLIN };
+        map[n++] = -1;
+    }
+
+    uint64_t now = mono_ms();
+    for (int i = 0; i < HTTP_MAX_CONNS; i++) {
+        struct http_conn *c = &srv->conn[i];
+        if (c->fd < 0)
+            continue;
+        if (now - c->since_ms >= HTTP_TIMEOUT_MS) {
+            http_close_conn(c);
+            continue;
+        }
+        int left = (int)(HTTP_TIMEOUT_MS - (now - c->since_ms));
+        if (timeout_ms < 0 || left < timeout_ms)
+            timeout_ms = left;
+        pfd[n] = (struct pollfd){ .fd = c->fd, .events = c->out ? POLLOUT : POLLIN };
+        map[n++] = i;
+    }
+
+    if (poll(pfd, n, timeout_ms) <= 0)
+        return 0;   // timeout or EINTR (stop signal)
+    int woke = 0;
+    now = mono_ms();
+    for (nfds_t i = 0; i < n; i++) {
+        if (!pfd[i].revents)
+            continue;
+        if (pfd[i].fd == wake_fd) {
+            woke = 1;
+            continue;
+        }
+        if (map[i] < 0) {
+            http_accept(srv, now);
+            continue;
+        }
+        struct http_conn *c = &srv->conn[map[i]];
+        if (c->out) http_writable(c);
+        else http_readable(srv, c);
+    }
+    return woke;
+}
+
+// ----- Tick source -----
+// Default publish interval (CPULOAD_INTERVAL_MS or -i overrides it).
+#define DEFAULT_INTERVAL_MS 10000
+#define MIN_INTERVAL_MS     10
+
+// Drift-free periodic ticks: timerfd when available, else clock_nanosleep(TIMER_ABSTIME)
+// on an absolute schedule. Returns the number of elapsed ticks (>1 = overrun).
+struct ticker {
+    int tfd;
+    unsigned interval_ms;
+    struct timespec next;
+};
+
+static void ticker_init(struct ticker *t, unsigned interval_ms) {
+    t->interval_ms = interval_ms;
+    struct timespec iv = { interval_ms / 1000, (long)(interval_ms % 1000) * 1000000L };
+    t->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (t->tfd >= 0) {
+        struct itimerspec its = { .it_interval = iv, .it_value = iv };
+        if (timerfd_settime(t->tfd, 0, &its, NULL) == 0)
+            return;
+        close(t->tfd);
+        t->tfd = -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t->next);
+}
+
+static volatile sig_atomic_t g_stop = 0;
+static volatile sig_atomic_t g_dump = 0;    // SIGUSR1: dump the log ring
+
+static void stop_handler(int sig) {
+    if (sig == SIGUSR1) g_dump = 1;
+    else g_stop = 1;
+}
+
+// Work requested by signals that interrupted the wait.
+static int ticker_interrupted(void) {
+    if (g_dump) {
+        g_dump = 0;
+        log_dump();
+    }
+    return g_stop;
+}
+
+// Returns the number of elapsed ticks, 0 once a stop signal arrived.
+// With an HTTP exporter (http != NULL) its requests are served while waiting.
+static uint64_t ticker_wait(struct ticker *t, struct http_server *http) {
+    if (ticker_interrupted()) return 0;   // signal arrived while sampling
+    if (t->tfd >= 0) {
+        uint64_t expirations;
+        if (http)
+            while (!http_poll(http, t->tfd, -1))
+                if (ticker_interrupted()) return 0;
+        for (;;) {
+            ssize_t n = read(t->tfd, &expirations, sizeof(expirations));
+            if (n == (ssize_t)sizeof(expirations)) return expirations;
+            if (ticker_interrupted()) return 0;
+            if (n < 0 && errno != EINTR) break;
+        }
+        close(t->tfd);   // should not happen; fall back to clock_nanosleep
+        t->tfd = -1;
+        clock_gettime(CLOCK_MONOTONIC, &t->next);
+    }
+    t->next.tv_sec += t->interval_ms / 1000;
+    t->next.tv_nsec += (long)(t->interval_ms % 1000) * 1000000L;
+    if (t->next.tv_nsec >= 1000000000L) { t->next.tv_sec++; t->next.tv_nsec -= 1000000000L; }
+    for (;;) {
+        if (http) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t left_ms = (int64_t)(t->next.tv_sec - now.tv_sec) * 1000 +
+                              (t->next.tv_nsec - now.tv_nsec + 999999) / 1000000;
+            if (left_ms <= 0)
+                break;
+            http_poll(http, -1, (int)left_ms);
+        } else if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t->next, NULL) != EINTR) {
+            break;
+        }
+        if (ticker_interrupted()) return 0;
+    }
+    // Far behind (e.g. suspended): restart the schedule instead of firing a burst.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t late_ms = (int64_t)(now.tv_sec - t->next.tv_sec) * 1000 +
+                      (now.tv_nsec - t->next.tv_nsec) / 1000000;
+    if (late_ms >= (int64_t)t->interval_ms) {
+        t->next = now;
+        return 1 + (uint64_t)late_ms / t->interval_ms;
+    }
+    return 1;
+}
+
+// ----- Smoothing -----
+// EWMA time constants. alpha = dt / (tau + dt) adapts to the actual tick length
+// (also after overruns) and needs no libm.
+static const float ewma_tau_s[3] = { 1.0f, 10.0f, 60.0f };
+
+static void ewma_update(float ewma[3], int *init, float value, float dt_s) {
+    for (int i = 0; i < 3; i++) {
+        if (!*init) ewma[i] = value;
+        else ewma[i] += dt_s / (ewma_tau_s[i] + dt_s) * (value - ewma[i]);
+    }
+    *init = 1;
+}
+
+// ----- Shared-memory channel -----
+static struct cpuload_shm *shm_channel_open(void) {
+    int fd = shm_open(CPULOAD_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+        perror("shm_open");
+        return NULL;
+    }
+    // Umask may have cut the mode; readers only need read access.
+    (void)fchmod(fd, 0644);
+    if (ftruncate(fd, sizeof(struct cpuload_shm)) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, sizeof(struct cpuload_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    struct cpuload_shm *shm = p;
+    // Left over from another layout: start from scratch, else keep the history across restarts.
+    if (shm->magic != CPULOAD_SHM_MAGIC || shm->version != CPULOAD_SHM_VERSION ||
+        shm->size != sizeof(*shm)) {
+        __atomic_store_n(&shm->magic, 0, __ATOMIC_RELAXED);
+        memset(&shm->seq, 0, sizeof(*shm) - offsetof(struct cpuload_shm, seq));
+    } else {
+        // A writer killed mid-update leaves seq odd; readers would see it busy until our first publish.
+        uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+        if (seq & 1)
+            __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELEASE);
+    }
+    // Header last: readers check the magic before trusting anything else.
+    shm->size = sizeof(*shm);
+    shm->version = CPULOAD_SHM_VERSION;
+    __atomic_store_n(&shm->magic, CPULOAD_SHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+}
+
+// ----- Socket fan-out -----
+// Subscribers are kept by address; the socket is drained once per tick (never blocks),
+// so a new client gets its first sample one interval after subscribing at the latest.
+struct subscribers {
+    int fd;
+    unsigned n;
+    struct sockaddr_un addr[CPULOAD_SOCK_MAX_SUBS];
+    socklen_t len[CPULOAD_SOCK_MAX_SUBS];
+    unsigned long dropped;                // removed because the client went away
+    unsigned long skipped;                // samples not delivered (client buffer full)
+};
+
+static int sub_open(struct subscribers *subs) {
+    memset(subs, 0, sizeof(*subs));
+    subs->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (subs->fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    memcpy(sa.sun_path + 1, CPULOAD_SOCK_NAME, strlen(CPULOAD_SOCK_NAME));
+    socklen_t len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + strlen(CPULOAD_SOCK_NAME));
+    if (bind(subs->fd, (struct sockaddr *)&sa, len) == -1) {
+        perror("bind @" CPULOAD_SOCK_NAME);
+        close(subs->fd);
+        subs->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int sub_find(const struct subscribers *subs, const struct sockaddr_un *sa, socklen_t len) {
+    for (unsigned i = 0; i < subs->n; i++)
+        if (subs->len[i] == len && memcmp(&subs->addr[i], sa, len) == 0)
+            return (int)i;
+    return -1;
+}
+
+static void sub_remove(struct subscribers *subs, unsigned i) {
+    subs->n--;
+    subs->addr[i] = subs->addr[subs->n];
+    subs->len[i] = subs->len[subs->n];
+}
+
+// Handles pending (un)subscribe requests.
+static void sub_drain(struct subscribers *subs) {
+    for (;;) {
+        char req[16];
+        struct sockaddr_un sa;
+        socklen_t len = sizeof(sa);
+        ssize_t n = recvfrom(subs->fd, req, sizeof(req), MSG_DONTWAIT, (struct sockaddr *)&sa, &len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;   // EAGAIN: nothing pending
+        }
+        // Unbound senders cannot be replied to.
+        if (n < 1 || len <= (socklen_t)offsetof(struct sockaddr_un, sun_path))
+            continue;
+        int i = sub_find(subs, &sa, len);
+        if (req[0] == CPULOAD_SOCK_SUBSCRIBE && i < 0) {
+            if (subs->n == CPULOAD_SOCK_MAX_SUBS) {
+                static struct ratelimit rl;
+                log_ratelimited(&rl, LOG_WARN, "subscriber limit (%d) reached", CPULOAD_SOCK_MAX_SUBS);
+                continue;
+            }
+            subs->addr[subs->n] = sa;
+            subs->len[subs->n] = len;
+            subs->n++;
+        } else if (req[0] == CPULOAD_SOCK_UNSUBSCRIBE && i >= 0) {
+            sub_remove(subs, (unsigned)i);
+        }
+    }
+}
+
+// Sends one record to every subscriber, batched into as few sendmmsg calls as possible.
+// sendmmsg stops at the first failing destination; that one is dropped (gone) or skipped
+// (receive buffer full), and the batch resumes behind it.
+static void sub_broadcast(struct subscribers *subs, const void *rec, size_t size) {
+    if (subs->n == 0)
+        return;
+    struct iovec iov = { .iov_base = (void *)rec, .iov_len = size };
+    struct mmsghdr msgs[CPULOAD_SOCK_MAX_SUBS];
+    for (unsigned i = 0; i < subs->n; i++) {
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &subs->addr[i];
+        msgs[i].msg_hdr.msg_namelen = subs->len[i];
+        msgs[i].msg_hdr.msg_iov = &iov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    unsigned char gone[CPULOAD_SOCK_MAX_SUBS] = {0};
+    unsigned i = 0;
+    while (i < subs->n) {
+        int r = sendmmsg(subs->fd, &msgs[i], subs->n - i, MSG_DONTWAIT);
+        if (r > 0) {
+            i += (unsigned)r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && (errno == ECONNREFUSED || errno == ENOENT || errno == ECONNRESET)) {
+            gone[i] = 1;
+            subs->dropped++;
+        } else {
+            subs->skipped++;
+        }
+        i++;
+    }
+    for (unsigned j = subs->n; j-- > 0;)
+        if (gone[j])
+            sub_remove(subs, j);
+}
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int parse_interval(const char *s, unsigned *out) {
+    char *end;
+    unsigned long v = strtoul(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < MIN_INTERVAL_MS || v > 3600000UL) {
+        fprintf(stderr, "[cpuloadd] invalid interval '%s' (ms, %d..3600000)\n", s, MIN_INTERVAL_MS);
+        return -1;
+    }
+    *out = (unsigned)v;
+    return 0;
+}
+
+static int parse_delta(const char *s, float *out) {
+    char *end;
+    float v = strtof(s, &end);
+    if (*s == '\0' || *end != '\0' || !(v >= 0.0f && v <= 100.0f)) {
+        fprintf(stderr, "[cpuloadd] invalid log delta '%s' (percent points, 0..100)\n", s);
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-i interval_ms] [-p [addr:]port] [-l error|warn|info|debug] [-d delta]\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned interval_ms = DEFAULT_INTERVAL_MS;
+    const char *env_iv = getenv("CPULOAD_INTERVAL_MS");
+    if (env_iv && *env_iv && parse_interval(env_iv, &interval_ms) != 0)
+        return 2;
+    const char *http_spec = getenv("CPULOAD_HTTP");
+    struct tick_log tick_log = {0};
+    const char *env_log = getenv("CPULOAD_LOG");
+    if (env_log && *env_log && parse_log_level(env_log) != 0)
+        return 2;
+    const char *env_delta = getenv("CPULOAD_LOG_DELTA");
+    if (env_delta && *env_delta && parse_delta(env_delta, &tick_log.delta) != 0)
+        return 2;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:p:l:d:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            if (parse_interval(optarg, &interval_ms) != 0) return 2;
+            break;
+        case 'p':
+            http_spec = optarg;
+            break;
+        case 'l':
+            if (parse_log_level(optarg) != 0) return 2;
+            break;
+        case 'd':
+            if (parse_delta(optarg, &tick_log.delta) != 0) return 2;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    struct cpuload_shm *shm = shm_channel_open();
+
+    // Optional legacy POSIX MQ. Non-blocking: a full queue must never stall sampling.
+    mqd_t q = (mqd_t)-1;
+    const char *env_mq = getenv("CPULOAD_MQ");
+    if (env_mq && *env_mq == '1') {
+        struct mq_attr attr = {0};
+        attr.mq_flags = 0;
+        attr.mq_maxmsg = 8;
+        attr.mq_msgsize = (long)CPULOAD_WIRE_MAX;
+        q = mq_open(MQ_NAME, O_CREAT | O_WRONLY | O_NONBLOCK, 0666, &attr);
+        // A queue left by an older daemon keeps its (text-sized) messages: recreate it.
+        struct mq_attr cur;
+        if (q != (mqd_t)-1 && mq_getattr(q, &cur) == 0 && cur.mq_msgsize < attr.mq_msgsize) {
+            mq_close(q);
+            mq_unlink(MQ_NAME);
+            q = mq_open(MQ_NAME, O_CREAT | O_WRONLY | O_NONBLOCK, 0666, &attr);
+        }
+        if (q == (mqd_t)-1)
+            perror("mq_open");
+    }
+
+    // Push channel for any number of clients; CPULOAD_SOCK=0 turns it off.
+    static struct subscribers subs;
+    subs.fd = -1;
+    const char *env_sock = getenv("CPULOAD_SOCK");
+    if (!(env_sock && *env_sock == '0'))
+        sub_open(&subs);
+
+    // Prometheus endpoint; asked for explicitly, so failing to bind is fatal.
+    static struct http_server http_srv;
+    struct http_server *http = NULL;
+    if (http_spec && *http_spec) {
+        if (http_open(&http_srv, http_spec) != 0)
+            return 1;
+        http = &http_srv;
+    }
+
+    if (!shm && q == (mqd_t)-1 && subs.fd < 0) {
+        fprintf(stderr, "[cpuloadd] no transport available\n");
         return 1;
     }
 
@@ -137,34 +1220,148 @@ int main(void) {
     const char *env_sim = getenv("CPULOAD_SIM");
     if (env_sim && *env_sim == '1') using_sim = 1;
 
-    printf("[cpuloadd] mq_open OK for '%s'; starting in %s mode\n",
-           MQ_NAME, using_sim ? "simulation" : "real");
-    fflush(stdout);
+    log_msg(LOG_INFO, "publishing via%s%s%s%s%s every %u ms; starting in %s mode",
+            shm ? " shm '" CPULOAD_SHM_NAME "'" : "",
+            subs.fd >= 0 ? " socket '@" CPULOAD_SOCK_NAME "'" : "",
+            q != (mqd_t)-1 ? " mq '" MQ_NAME "'" : "",
+            http ? " http " : "", http ? http_spec : "",
+            interval_ms, using_sim ? "simulation" : "real");
 
     // Number of consecutive real-read failures before switching to simulation.
     int fail_budget = 3;
+    int was_sim = using_sim;
+    unsigned last_subs = 0;
+    struct ratelimit rl_missed = {0}, rl_mq = {0};
+
+    float ewma[3];
+    int ewma_init = 0;
+
+    // No SA_RESTART: the signal has to interrupt the blocking tick wait.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);   // HTTP clients may hang up mid-response
+
+    struct ticker ticker;
+    cpu_sampler_prime();
+    ticker_init(&ticker, interval_ms);
 
-    char buf[64];
+    static struct cpuload_wire wire;
+    struct daemon_stats stats = {0};
     for (;;) {
-        int sample_from_sim = 0;
-        double val = get_cpu_load_real_or_sim(&using_sim, &fail_budget, &sample_from_sim);
-        printf("[cpuloadd] %s CPU load: %.1f%%\n",
-               sample_from_sim ? "simulated" : "real", val);
-        fflush(stdout);
-        int n = snprintf(buf, sizeof(buf), "%.1f", val);
-        if (n < 0) n = 0;
+        uint64_t ticks = ticker_wait(&ticker, http);
+        if (ticks == 0)
+            break;
 
-        if (mq_send(q, buf, (size_t)n + 1, 0) == -1) {
-            perror("mq_send");
-            // If the queue is full or absent, do not exit. Try next tick.
+        static struct cpuload_sample smp;
+        memset(&smp, 0, sizeof(smp));
+        uint64_t t0 = mono_ns();
+        double val = get_cpu_load_real_or_sim(&using_sim, &fail_budget, &smp);
+        read_loadavg(&smp);
+        read_pressure(&smp);
+        stats.sample_ns_last = mono_ns() - t0;
+        stats.sample_ns_total += stats.sample_ns_last;
+        stats.ticks++;
+        stats.ticks_missed += ticks - 1;
+        ewma_update(ewma, &ewma_init, smp.load, (float)(ticks * interval_ms) / 1000.0f);
+        memcpy(smp.load_ewma, ewma, sizeof(ewma));
+        smp.timestamp_ns = realtime_ns();
+        smp.interval_ms = interval_ms;
+
+        float core_max = -1.0f;
+        for (unsigned i = 0; i < smp.ncpus; i++)
+            if (smp.core[i] > core_max) core_max = smp.core[i];
+
+        if (shm) {
+            cpuload_publish(shm, &smp);
+            struct cpuload_hist_entry he = {
+                .timestamp_ns = smp.timestamp_ns,
+                .load = smp.load,
+                .core_max = core_max,
+                .psi_cpu = (smp.flags & CPULOAD_F_PSI) ? smp.psi[CPULOAD_PSI_CPU].some[0] : -1.0f,
+                .procs_running = (smp.flags & CPULOAD_F_RUNQ) ? smp.procs_running : 0,
+            };
+            cpuload_hist_push(shm, &he);
+        }
+
+        // Message transports carry the binary record (cpuload.h), encoded once per tick.
+        size_t wire_len = 0;
+        if (subs.fd >= 0 || q != (mqd_t)-1)
+            wire_len = cpuload_wire_encode(&smp, &wire);
+
+        if (subs.fd >= 0) {
+            sub_drain(&subs);
+            sub_broadcast(&subs, &wire, wire_len);
+        }
+
+        if (q != (mqd_t)-1) {
+            if (mq_send(q, (const char *)&wire, wire_len, 0) == -1 && errno != EAGAIN) {
+                // If the queue is absent, do not exit. Try next tick.
+                log_event(LOGEV_MQ_ERR, (uint32_t)errno, smp.timestamp_ns, NULL, 0);
+                log_ratelimited(&rl_mq, LOG_WARN, "mq_send: %s", strerror(errno));
+            }
         }
 
-        // Every 10 seconds as required.
-        sleep(10);
+        if (http) {
+            stats.subscribers = subs.n;
+            http_render(http, &smp, &stats);
+        }
+
+        // Events always end up in the ring; text only as far as level and rate allow.
+        log_event(LOGEV_TICK, (uint32_t)ticks, smp.timestamp_ns, &smp, core_max);
+        if (ticks > 1) {
+            log_event(LOGEV_MISSED, (uint32_t)(ticks - 1), smp.timestamp_ns, &smp, core_max);
+            log_ratelimited(&rl_missed, LOG_WARN, "%llu ticks missed", (unsigned long long)(ticks - 1));
+        }
+        if (using_sim != was_sim) {
+            log_event(LOGEV_SIM, (uint32_t)using_sim, smp.timestamp_ns, &smp, core_max);
+            log_msg(LOG_WARN, "/proc/stat unusable, switching to simulation");
+            was_sim = using_sim;
+        }
+        if (subs.n != last_subs) {
+            log_event(LOGEV_SUBS, subs.n, smp.timestamp_ns, NULL, 0);
+            log_msg(LOG_DEBUG, "%u subscribers", subs.n);
+            last_subs = subs.n;
+        }
+
+        if (!tick_log_due(&tick_log, smp.load, mono_ms()))
+            continue;
+
+        char line[256];
+        size_t n = (size_t)snprintf(line, sizeof(line), "%s CPU load: %.1f%%",
+                                    (smp.flags & CPULOAD_F_SIM) ? "simulated" : "real", val);
+        if (smp.ncpus > 0 && n < sizeof(line))
+            n += (size_t)snprintf(line + n, sizeof(line) - n, " (%u cores, max %.1f%%)", smp.ncpus, core_max);
+        if ((smp.flags & CPULOAD_F_RUNQ) && n < sizeof(line))
+            n += (size_t)snprintf(line + n, sizeof(line) - n, " runq %u/%u",
+                                  smp.procs_running, smp.procs_blocked);
+        if ((smp.flags & CPULOAD_F_PSI) && n < sizeof(line))
+            n += (size_t)snprintf(line + n, sizeof(line) - n, " psi cpu %.2f mem %.2f io %.2f",
+                                  smp.psi[CPULOAD_PSI_CPU].some[0], smp.psi[CPULOAD_PSI_MEM].some[0],
+                                  smp.psi[CPULOAD_PSI_IO].some[0]);
+        if (n < sizeof(line))
+            n += (size_t)snprintf(line + n, sizeof(line) - n, " ewma %.1f/%.1f/%.1f",
+                                  ewma[0], ewma[1], ewma[2]);
+        if (subs.n > 0 && n < sizeof(line))
+            snprintf(line + n, sizeof(line) - n, " subs %u", subs.n);
+        log_msg(LOG_INFO, "%s", line);
     }
 
-    // Not reached in daemon-style loop
-    // mq_close(q); mq_unlink(MQ_NAME);
+    // The shm object stays: readers notice the stale timestamp, a restarted daemon reuses it.
+    log_msg(LOG_INFO, "stopping after %llu ticks", (unsigned long long)stats.ticks);
+    if (shm) munmap(shm, sizeof(*shm));
+    if (q != (mqd_t)-1) mq_close(q);
+    if (subs.fd >= 0) close(subs.fd);
+    if (http) {
+        for (int i = 0; i < HTTP_MAX_CONNS; i++)
+            if (http->conn[i].fd >= 0) http_close_conn(&http->conn[i]);
+        close(http->lfd);
+        free(http->body);
+    }
     return 0;
 }
 
@@ -174,5 +1371,6 @@ Notes:
   will automatically fall back to simulated values after 3 failed attempts.
 - To keep pure-simulation behavior, compile with -DUSE_SIMULATION
   or run with CPULOAD_SIM=1.
-- Mini shell must reads from the same MQ and prints the most recent value every 10 s.
+- Mini shell maps the same shm object and reads the most recent value at prompt time;
+  without shm it subscribes on the socket, and only then falls back to the MQ.
 */
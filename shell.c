@@ -1,47 +1,359 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>        // isdigit (printf, test)
 #include <unistd.h>       // fork, execvp, chdir, getcwd, pipe
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>     // timeradd/timersub
+#include <sys/resource.h> // struct rusage, wait4
 #include <signal.h>
 #include <errno.h>
+#include <spawn.h>        // posix_spawn
+#include <sys/stat.h>
+#include <limits.h>       // PATH_MAX
+#include <time.h>         // clock_gettime
+#include <termios.h>
+#include <sys/ioctl.h>    // TIOCGWINSZ für den Zeileneditor
+#include <sys/mman.h>
+#include <sys/uio.h>      // writev
+#include <sys/file.h>     // flock für die Verlaufsdatei
+#include <sys/sendfile.h>
+#include <sched.h>        // sched_setaffinity, SCHED_BATCH/SCHED_IDLE
+#include <sys/syscall.h>  // ioprio_set (kein glibc-Wrapper)
+#include <pwd.h>          // getpwuid für \u im Prompt
 
-// MQ/ Pthread-Add-on
+extern char **environ;
+
+// MQ/ Event-Loop
 #include <mqueue.h>
-#include <pthread.h>
 #include <fcntl.h>        // O_RDONLY
+#include <sys/epoll.h>
+#include <poll.h>         // parallel: Eingabe und signalfd zugleich
+#include <sys/signalfd.h>
+#include <sys/socket.h>   // Push-Kanal von cpuloadd
+#include <sys/un.h>
+#include <stddef.h>       // offsetof
+
+// Shared-Memory-Kanal von cpuloadd (Seqlock, siehe cpuload.h)
+#include "cpuload.h"
+
+// USDT-Probes (systemtap-sdt-dev): ohne den Header werden die Tracepunkte zu nichts
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_SDT 1
+#endif
+#endif
+#ifndef HAVE_SDT
+#define DTRACE_PROBE2(provider, name, a, b) ((void)0)
+#endif
+
+// Arena: Bump-Allocator für alles, was pro Eingabezeile entsteht.
+// arena_reset() gibt nichts frei, sondern setzt nur die Füllstände zurück.
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size, used;
+    char data[];
+};
+struct arena {
+    struct arena_chunk *head;   // erster Chunk
+    struct arena_chunk *cur;    // aktuell befüllter Chunk
+    size_t used;                // seit dem letzten Reset vergeben
+    size_t high_water;          // Maximum von used über alle Zeilen
+    size_t reserved;            // Summe aller Chunk-Größen
+    unsigned nchunks;
+    unsigned long resets;
+};
+#define ARENA_CHUNK_MIN 4096
+
+// Tokens des Lexers; Wörter zeigen direkt in den Zeilenpuffer
+enum tok_type {
+    TOK_WORD,
+    TOK_PIPE,          // |
+    TOK_AMP,           // &
+    TOK_SEMI,          // ;
+    TOK_AND,           // &&
+    TOK_OR,            // ||
+    TOK_REDIR_IN,      // [n]<
+    TOK_REDIR_OUT,     // [n]>
+    TOK_REDIR_APPEND,  // [n]>>
+    TOK_REDIR_DUP,     // [n]>&m, [n]<&m
+    TOK_HERESTR,       // [n]<<< wort
+};
+struct token {
+    enum tok_type type;
+    char *text;        // nur TOK_WORD (NUL-terminiert)
+    int fd;            // Umlenkungen: Ziel-Deskriptor, -1 = Standard
+    int status;        // TOK_WORD enthält STATUS_MARK ($?)
+    int off, end;      // Position im Originaltext
+};
+
+// Platzhalter, den der Lexer für ein $? einsetzt (nicht in einfachen Quotes);
+// erst direkt vor der Ausführung der Pipeline durch den Status ersetzt
+#define STATUS_MARK '\001'
+
+// Syntaxbaum einer Zeile; liegt komplett in der Zeilen-Arena
+struct redir {
+    enum tok_type type;       // TOK_REDIR_* / TOK_HERESTR
+    int fd;                   // umgelenkter Deskriptor
+    char *target;             // Dateiname, Quell-Deskriptor (DUP) bzw. Text (HERESTR)
+    struct redir *next;
+};
+// limit res=wert,...: setrlimit im Kind (weich = hart, der Job kann sie nicht anheben)
+#define MAX_RLIMITS 8
+struct rlimit_pref {
+    int resource;             // RLIMIT_*
+    rlim_t value;
+};
+// Präfixe pin/nice/batch/idle/ioprio/cgroup/limit einer Stufe; im Kind vor exec angewendet
+struct sched_prefs {
+    int has_affinity;
+    cpu_set_t cpus;
+    int has_nice;
+    int nice;                 // relativ, wie nice(1)
+    int policy;               // -1 = unverändert, sonst SCHED_BATCH / SCHED_IDLE
+    int ioprio;               // -1 = unverändert, sonst IOPRIO_PRIO_VALUE(class, level)
+    const char *cgroup_procs; // ".../cgroup.procs" oder NULL
+    int nlimits;
+    struct rlimit_pref limits[MAX_RLIMITS];
+};
+
+struct command {              // eine Pipeline-Stufe
+    int argc;
+    char **argv;              // NULL-terminiert
+    struct redir *redirs;
+    struct sched_prefs *sched;   // NULL = keine Präfixe
+};
+// Verknüpfung mit der vorigen Pipeline einer Liste
+enum list_op { LIST_SEQ, LIST_AND, LIST_OR };   // ; bzw. &   &&   ||
 
-// Line Definition
-#define MAX_LINE 256
-#define MAX_ARGS 32
+struct pipeline {
+    int ncmds;
+    struct command *cmds;
+    int background;
+    int timed;                // mit "time" vorangestellt
+    int has_status;           // ein Wort enthält $?
+    char *text;               // Originaltext für die Jobtabelle
+    enum list_op op;
+    struct pipeline *next;    // nächste Pipeline der Zeile
+};
 
-// MQ/ Pthread-Add-on globales
-// POSIX Message Queue Handle
+// MQ-Globales
+// POSIX Message Queue Handle (unter Linux ein pollbarer Deskriptor)
 static mqd_t g_mq = (mqd_t)-1;
 
-// letzter bekannter CPU-Lastwert; -1 = noch nichts empfangen
-static int current_cpu_load = -1;
+// cpuloadd-Shared-Memory (nur lesend gemappt); NULL = nicht verbunden
+static const struct cpuload_shm *g_cpu_shm = NULL;
+static time_t g_cpu_shm_retry = 0;   // nächster Verbindungsversuch
+
+// Abonnement auf dem Datagramm-Socket "@cpuload" (nur ohne shm, z.B. anderer /dev/shm)
+static int g_cpu_sock = -1;
+// letzter über Socket oder MQ empfangener Datensatz (dekodiertes struct cpuload_wire)
+static int g_cpu_push_valid = 0;
+static struct cpuload_sample g_cpu_push;
+static time_t g_cpu_sub_retry = 0;   // nächstes (erneutes) Abonnieren
+
+// Event-Loop: stdin, Signale (signalfd), MQ und cpuload-Socket auf einem Thread
+enum { EV_STDIN = 1, EV_SIGNAL, EV_MQ, EV_CPUSOCK };
+static int g_epfd = -1;
+static int g_sigfd = -1;
+static int g_stdin_pollable = 0;     // 0 z.B. bei regulärer Datei als stdin
+static int g_stdin_armed = 0;        // stdin gerade im epoll-Set aktiv
+static int g_at_prompt = 0;          // Prompt wird gerade angezeigt
+static void prompt_redraw(void);
+static void cwd_changed(void);
+static void ed_refresh(void);
+
+// Eingabepuffer (ersetzt fgets; liest stdin nur, wenn epoll es meldet).
+// Bei -c bzw. Skriptdatei zeigt g_in direkt auf den String bzw. das mmap.
+static char g_inbuf[65536];
+static const char *g_in = g_inbuf;
+static size_t g_inlen = 0, g_inpos = 0;
+static int g_in_mem = 0;             // Eingabe liegt komplett im Speicher
+
+// Batch-Modus (-c, Skriptdatei oder stdin kein Terminal): kein Prompt,
+// keine Statusmeldungen, nur der Exit-Status zählt
+static int g_batch = 0;
+static int g_last_status = 0;        // Status des zuletzt beendeten Vordergrund-Kommandos
+
+// Arena für die aktuelle Eingabezeile (Tokens, argv-Arrays, ...)
+static struct arena g_line_arena;
+
+// Tracepunkte: jeder ist eine USDT-Probe "minishell:<name>" (arg0 Text oder NULL,
+// arg1 Zahl; z.B. bpftrace -e 'usdt:./shell:minishell:spawn_end { ... }') und landet
+// mit "trace on" (oder MINISHELL_TRACE=1) zusätzlich im Ring g_trace. Ausgeschaltet
+// kostet ein Tracepunkt ein nop und einen nie genommenen Sprung.
+#define TRACE_EVENTS(X) \
+    X(parse_begin)   /* Zeilentext, Länge */                    \
+    X(parse_end)     /* -, Pipelines oder -1 */                 \
+    X(builtin_begin) /* Name, - */                              \
+    X(builtin_end)   /* Name, Status */                         \
+    X(lookup)        /* Name, 1 = aus dem Pfad-Cache */         \
+    X(spawn_begin)   /* Name, Engine */                         \
+    X(spawn_end)     /* Name, PID oder -errno */                \
+    X(process)       /* Kommando, Hintergrund */                \
+    X(pipe_begin)    /* Kommando, Stufen */                     \
+    X(pipe_end)      /* Kommando, gestartete Prozesse */        \
+    X(wait_begin)    /* Job, Prozessgruppe */                   \
+    X(wait_end)      /* Job, Status */                          \
+    X(mq_recv)       /* -, Bytes */                             \
+    X(sock_recv)     /* -, Bytes */
+#define TRACE_ENUM(n) TR_##n,
+enum trace_ev { TRACE_EVENTS(TRACE_ENUM) TR_COUNT };
+#undef TRACE_ENUM
+
+#define TRACE_RING 4096
+struct trace_rec {
+    uint64_t ns;              // CLOCK_MONOTONIC
+    long arg;
+    uint16_t ev;
+    char text[22];            // Anfang von arg0
+};
+static struct trace_rec g_trace[TRACE_RING];
+static uint32_t g_trace_n = 0;      // insgesamt aufgezeichnet
+static int g_trace_on = 0;
+
+__attribute__((noinline, cold))
+static void trace_record(enum trace_ev ev, const char *text, long arg) {
+    struct trace_rec *r = &g_trace[g_trace_n++ % TRACE_RING];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    r->ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    r->ev = (uint16_t)ev;
+    r->arg = arg;
+    size_t i = 0;
+    if (text)
+        for (; i + 1 < sizeof(r->text) && text[i]; i++)
+            r->text[i] = text[i];
+    r->text[i] = '\0';
+}
+
+#define TRACE(name, text, arg) do {                                      \
+        DTRACE_PROBE2(minishell, name, text, arg);                       \
+        if (__builtin_expect(g_trace_on, 0))                             \
+            trace_record(TR_##name, (text), (long)(arg));                \
+    } while (0)
+
+// Spawn-Engine: posix_spawn (vfork-artig, ohne Kopie der Page-Tables)
+// oder klassisch fork + execvp als Fallback
+enum spawn_engine { SPAWN_POSIX = 0, SPAWN_FORK = 1, SPAWN_ENGINES };
+static const char *const spawn_engine_names[SPAWN_ENGINES] = { "posix_spawn", "fork" };
+static enum spawn_engine g_spawn_engine = SPAWN_POSIX;
+
+// Start-Latenz je Engine (Zeit bis exec im Kind erfolgreich war)
+struct spawn_stat {
+    unsigned long count;
+    unsigned long long total_ns, min_ns, max_ns;
+};
+static struct spawn_stat g_spawn_stats[SPAWN_ENGINES];
+
+// Engine und Latenz des letzten erfolgreichen Starts (für die Ausgabe)
+static enum spawn_engine g_last_spawn_engine;
+static unsigned long long g_last_spawn_ns;
+
+// Pfad-Cache für externe Kommandos (wie bashs 'hash'): Name -> absoluter Pfad.
+// Gilt nur für den PATH, mit dem er befüllt wurde.
+#define HASH_BUCKETS 64
+struct hash_entry {
+    char *name;
+    char *path;
+    unsigned long hits;
+    struct hash_entry *next;
+};
+static struct hash_entry *g_hash[HASH_BUCKETS];
+static char *g_hash_path_env = NULL;
+
+// Puffergröße für Pipeline-Pipes (F_SETPIPE_SZ); 0 = Kernel-Default
+static int g_pipe_size = 0;
+
+// Umlenkung, wie sie im Kind (bzw. für Built-Ins in der Shell) angewendet wird:
+// dup2(from, to). Von der Shell geöffnete Deskriptoren (owned) liegen ab
+// MIN_REDIR_FD mit CLOEXEC und werden nach dem Start wieder geschlossen.
+#define MIN_REDIR_FD 10
+struct fd_map {
+    int from, to;
+    int owned;
+};
 
-// Synchronisation für current_cpu_load
-static pthread_mutex_t g_cpu_mtx = PTHREAD_MUTEX_INITIALIZER;
+// Built-In: argv -> Exit-Status. Die Tabelle (g_builtins) ist nach Namen sortiert.
+// stage: ändert keinen Shell-Zustand und darf in einem geforkten Kind laufen
+// (Pipeline-Stufe, &, Präfixe, parallel); alle anderen laufen immer in der Shell selbst.
+typedef int builtin_fn(char *args[]);
+struct builtin {
+    const char *name;
+    builtin_fn *fn;
+    int stage;
+};
+static const struct builtin *builtin_find(const char *name);
+static int g_stage_child = 0;   // 1 im geforkten Kind eines Built-Ins als Stufe
 
-// Thread-Steuerung
-static int g_mq_thread_running = 0;   // 1 = Thread-Schleife läuft
-static int g_mq_thread_started = 0;   // 1 = Thread wurde erfolgreich gestartet
-static pthread_t g_mq_tid;
+// Optionen für spawn_cmd()
+struct spawn_opts {
+    int in_fd, out_fd;        // -1 = erben
+    const int *close_fds;     // im Kind zu schließen (z.B. Pipe-Enden)
+    int nclose;
+    const struct fd_map *maps;  // Umlenkungen, nach in_fd/out_fd angewendet
+    int nmaps;
+    pid_t pgid;               // -1 = keine eigene Gruppe, 0 = neue Gruppe, >0 = beitreten
+    int foreground;           // Terminal an die Gruppe übergeben
+    const struct sched_prefs *sched;   // Präfixe der Stufe oder NULL
+    builtin_fn *builtin;      // statt exec im geforkten Kind ausführen (oder NULL)
+    const char *cgroup_procs; // cgroup des Jobs (jobcg) oder NULL; ein cgroup-Präfix hat Vorrang
+};
+
+// Job-Control
+static int g_interactive = 0;        // stdin ist ein Terminal -> eigene Prozessgruppen
+static pid_t g_shell_pgid;
+static struct termios g_shell_tmodes;
+
+#define MAX_JOBS 64
+enum job_state { JOB_FREE = 0, JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+struct job_proc {
+    pid_t pid;
+    int status;               // waitpid-Status, sobald fertig
+    enum job_state state;
+    struct rusage ru;         // Ressourcen laut wait4, sobald fertig
+    unsigned long long end_ns;
+};
+struct job {
+    int id;                   // Jobnummer für %n
+    enum job_state state;
+    pid_t pgid;
+    int background;
+    int nprocs;
+    struct job_proc *procs;
+    char *cmd;
+    struct termios tmodes;    // Terminal-Modi des gestoppten Jobs
+    int has_tmodes;
+    int timed;                // Ressourcen nach Ende ausgeben ("time" / timing on)
+    unsigned long long start_ns, end_ns;
+    char *cg;                 // eigene cgroup-v2-Leaf (jobcg) oder NULL
+};
+static struct job g_jobs[MAX_JOBS];
+
+// timing on: Ressourcenbericht für jedes Kommando, nicht nur mit "time"
+static int g_timing_always = 0;
+
+// jobcg on: jeder Job bekommt eine Leaf-cgroup unter diesem Verzeichnis (NULL = aus)
+static char *g_jobcg_parent = NULL;
+static unsigned g_jobcg_seq = 0;
+
+// Signalbehandlung (aus der Event-Loop über signalfd, nicht im Handler-Kontext)
+static unsigned g_sigint_count = 0;   // z.B. damit parallel keine neuen Jobs startet
 
-// Signal-Handler
 void signal_handler(int sig) {
     switch (sig) {
         case SIGINT:   // Strg + C
+            g_sigint_count++;
             printf("\n(SIGINT empfangen – Shell bleibt aktiv. Zum Beenden 'exit' verwenden)\n");
-            printf("sh> ");
+            if (g_at_prompt) prompt_redraw();
             fflush(stdout);
             break;
         case SIGTSTP:  // Strg + Z
             printf("\n(SIGTSTP empfangen – ignoriert)\n");
-            printf("sh> ");
+            if (g_at_prompt) prompt_redraw();
             fflush(stdout);
             break;
         case SIGTERM:
@@ -61,64 +373,191 @@ void signal_handler(int sig) {
     }
 }
 
-// MQ/Pthread-Add-on
-static void *mq_listener(void *arg) {
-    (void)arg;
-    // Blockierendes Lesen aus der MQ; robust gegen EINTR
-    while (__atomic_load_n(&g_mq_thread_running, __ATOMIC_RELAXED)) {
-        char buf[64];
+// Empfangspuffer für Socket und MQ (Binärdatensätze, siehe cpuload.h)
+static struct cpuload_wire g_cpu_wire;
+
+static void cpu_push_store(ssize_t n) {
+    if (n > 0 && cpuload_wire_decode(&g_cpu_wire, (size_t)n, &g_cpu_push) == 0)
+        g_cpu_push_valid = 1;
+}
+
+// MQ: alle anstehenden Nachrichten lesen, der neueste Datensatz gewinnt
+static void mq_drain(void) {
+    for (;;) {
         unsigned int prio = 0;
-        ssize_t n = mq_receive(g_mq, buf, sizeof(buf), &prio);
-        if (n >= 0) {
-            buf[sizeof(buf)-1] = '\0';
-            int val = atoi(buf);
-            if (val < 0)   val = 0;
-            if (val > 100) val = 100;
-
-            pthread_mutex_lock(&g_cpu_mtx);
-            current_cpu_load = val;
-            pthread_mutex_unlock(&g_cpu_mtx);
-        } else {
-            if (errno == EINTR) continue;   // unterbrochen durch Signal → weiter
-            // Bei anderen Fehlern kurz „atmen“, nicht crashen
-            usleep(100000);
+        ssize_t n = mq_receive(g_mq, (char *)&g_cpu_wire, sizeof(g_cpu_wire), &prio);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;   // EAGAIN: Queue leer
         }
+        TRACE(mq_recv, (const char *)NULL, n);
+        cpu_push_store(n);
     }
-    return NULL;
+}
+
+// Shared Memory von cpuloadd mappen. Ohne O_CREAT: fehlt der Daemon,
+// bleibt es bei n/a bzw. der MQ.
+static int cpu_shm_attach(void) {
+    int fd = shm_open(CPULOAD_SHM_NAME, O_RDONLY, 0);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct cpuload_shm)) {
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, sizeof(struct cpuload_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -1;
+    const struct cpuload_shm *shm = p;
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != CPULOAD_SHM_MAGIC ||
+        shm->version != CPULOAD_SHM_VERSION) {
+        munmap(p, sizeof(struct cpuload_shm));
+        return -1;
+    }
+    g_cpu_shm = shm;
+    return 0;
+}
+
+static void cpu_shm_detach(void) {
+    if (g_cpu_shm) {
+        munmap((void *)g_cpu_shm, sizeof(struct cpuload_shm));
+        g_cpu_shm = NULL;
+    }
+}
+
+// Socket mit eigener (autobind-)Adresse anlegen, damit cpuloadd antworten kann
+static int cpu_sock_open(void) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    struct sockaddr_un self = { .sun_family = AF_UNIX };
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_CPUSOCK };
+    if (bind(fd, (struct sockaddr *)&self, sizeof(sa_family_t)) == -1 ||
+        epoll_ctl(g_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        close(fd);
+        return -1;
+    }
+    g_cpu_sock = fd;
+    return 0;
+}
+
+// (Ab-)Meldung bei cpuloadd; -1, wenn der Daemon nicht läuft.
+// Doppelte Anmeldungen ignoriert der Daemon, erneutes Senden ist also harmlos.
+static int cpu_sock_request(char req) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    memcpy(sa.sun_path + 1, CPULOAD_SOCK_NAME, strlen(CPULOAD_SOCK_NAME));
+    socklen_t len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + strlen(CPULOAD_SOCK_NAME));
+    return sendto(g_cpu_sock, &req, 1, MSG_DONTWAIT, (struct sockaddr *)&sa, len) == 1 ? 0 : -1;
+}
+
+// Alle anstehenden Datensätze lesen, der neueste gewinnt
+static void cpu_sock_drain(void) {
+    for (;;) {
+        ssize_t n = recv(g_cpu_sock, &g_cpu_wire, sizeof(g_cpu_wire), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        TRACE(sock_recv, (const char *)NULL, n);
+        cpu_push_store(n);
+    }
+}
+
+static void cpu_sock_close(void) {
+    if (g_cpu_sock >= 0) {
+        cpu_sock_request(CPULOAD_SOCK_UNSUBSCRIBE);
+        close(g_cpu_sock);
+        g_cpu_sock = -1;
+    }
+}
+
+// drei Intervalle, mindestens 2 s (kurze Intervalle vertragen kein Jitter)
+static int cpu_sample_fresh(const struct cpuload_sample *smp, uint64_t now_ns) {
+    uint64_t max_age = 3ull * smp->interval_ms * 1000000ull;
+    if (max_age < 2000000000ull) max_age = 2000000000ull;
+    return smp->timestamp_ns != 0 && now_ns - smp->timestamp_ns <= max_age;
+}
+
+// shm einblenden; danach Socket-Abo abmelden, sonst weckt jeder Tick die Shell umsonst
+static void cpu_shm_ensure(time_t now) {
+    if (!g_cpu_shm && now >= g_cpu_shm_retry) {
+        // höchstens alle 5 s neu versuchen
+        g_cpu_shm_retry = now + 5;
+        if (cpu_shm_attach() == 0)
+            cpu_sock_close();
+    }
+}
+
+// Aktuellen Datensatz holen: 1 = frischer Datensatz (shm, Socket oder MQ), -1 = n/a.
+// Über shm kostet das keinen Syscall außer clock_gettime (vDSO).
+static int cpu_sample_now(struct cpuload_sample *out) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    cpu_shm_ensure(now.tv_sec);
+    if (g_cpu_shm) {
+        if (cpuload_read(g_cpu_shm, out) == 0 && out->timestamp_ns != 0) {
+            if (cpu_sample_fresh(out, now_ns))
+                return 1;
+            // veraltet: Daemon weg oder Objekt neu angelegt -> später neu mappen,
+            // bis dahin wieder über den Socket abonnieren
+            cpu_shm_detach();
+            if (g_cpu_sock < 0 && cpu_sock_open() == 0)
+                g_cpu_sub_retry = 0;
+        }
+    }
+    if (g_cpu_push_valid && cpu_sample_fresh(&g_cpu_push, now_ns)) {
+        *out = g_cpu_push;
+        return 1;
+    }
+    // nichts (mehr) empfangen, z.B. Daemon neu gestartet: neu abonnieren
+    if (g_cpu_sock >= 0 && !g_cpu_shm && now.tv_sec >= g_cpu_sub_retry) {
+        g_cpu_sub_retry = now.tv_sec + 5;
+        cpu_sock_request(CPULOAD_SOCK_SUBSCRIBE);
+    }
+    return -1;
+}
+
+// Lastanzeige für den Prompt, z.B. "CPU 37.5% max 91% psi 2.1%" (smp NULL = n/a).
+// Max-Core nur bei mehr als einem Kern, PSI nur wenn der Kernel sie liefert.
+static size_t cpu_prompt_format(const struct cpuload_sample *smp, char *buf, size_t size) {
+    if (!smp)
+        return (size_t)snprintf(buf, size, "CPU n/a");
+    size_t n = (size_t)snprintf(buf, size, "CPU %.1f%%", smp->load);
+    if (smp->ncpus > 1 && n < size) {
+        float max = 0;
+        for (uint32_t i = 0; i < smp->ncpus && i < CPULOAD_MAX_CPUS; i++)
+            if (smp->core[i] > max) max = smp->core[i];
+        n += (size_t)snprintf(buf + n, size - n, " max %.0f%%", max);
+    }
+    if ((smp->flags & CPULOAD_F_PSI) && n < size)
+        n += (size_t)snprintf(buf + n, size - n, " psi %.1f%%", smp->psi[CPULOAD_PSI_CPU].some[0]);
+    return n < size ? n : size - 1;
 }
 
 static void mq_start_if_available(void) {
     // Ohne O_CREAT, damit die Shell auch ohne cpuloadd einfach weiterläuft.
-    g_mq = mq_open("/cpuload", O_RDONLY);
+    g_mq = mq_open(CPULOAD_MQ_NAME, O_RDONLY | O_NONBLOCK);
     if (g_mq == (mqd_t)-1) {
-        fprintf(stderr, "[Hinweis] /cpuload nicht verfügbar (cpuloadd läuft?). CPU-Anzeige = n/a\n");
+        if (!g_cpu_shm)
+            fprintf(stderr, "[Hinweis] /cpuload nicht verfügbar (cpuloadd läuft?). CPU-Anzeige = n/a\n");
         return;
     }
 
-    // Listener starten
-    g_mq_thread_running = 1;
-    if (pthread_create(&g_mq_tid, NULL, mq_listener, NULL) != 0) {
-        fprintf(stderr, "[Warnung] Konnte MQ-Listener-Thread nicht starten.\n");
-        g_mq_thread_running = 0;
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_MQ };
+    if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, (int)g_mq, &ev) == -1) {
+        fprintf(stderr, "[Warnung] /cpuload nicht pollbar: %s\n", strerror(errno));
         mq_close(g_mq);
         g_mq = (mqd_t)-1;
         return;
     }
-    g_mq_thread_started = 1;
-    // Detach optional, hier  joinbar für sauberes Beenden lassen
+    mq_drain();
 }
 
 static void mq_stop_and_close(void) {
-    if (g_mq_thread_started) {
-        g_mq_thread_running = 0;
-        // Wakeup: mq_receive blockiert; wir könnten ein Dummy-Signal schicken
-        // aber ein kurzer Timeout/Signal reicht hier -> Notfalls minimal warten
-        // sleep, dann join
-        usleep(200000);
-        pthread_cancel(g_mq_tid);      // falls noch blockiert
-        pthread_join(g_mq_tid, NULL);
-        g_mq_thread_started = 0;
-    }
     if (g_mq != (mqd_t)-1) {
         mq_close(g_mq);
         g_mq = (mqd_t)-1;
@@ -126,218 +565,4509 @@ static void mq_stop_and_close(void) {
 }
 
 // Hilfsfunktionen
-// entfernt das abschließende '\n' von fgets
+// entfernt das abschließende '\n' einer Eingabezeile
 void trim_newline(char *s) {
     size_t n = strlen(s);
     if (n && s[n - 1] == '\n')
         s[n - 1] = '\0';
 }
 
-// Zerlegt eine Befehlszeile in Tokens
-int parse_line(char *line, char *args[]) {
-    int i = 0;
-    char *token = strtok(line, " \t");
-    while (token != NULL && i < MAX_ARGS - 1) {
-        args[i++] = token;
-        token = strtok(NULL, " \t");
+// Arena
+static void *arena_alloc(struct arena *a, size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    struct arena_chunk *c = a->cur;
+    // nächsten passenden (bereits vorhandenen) Chunk suchen
+    while (c && c->used + n > c->size)
+        c = c->next;
+    if (!c) {
+        size_t size = n > ARENA_CHUNK_MIN ? n : ARENA_CHUNK_MIN;
+        if (a->cur && a->cur->size * 2 > size)
+            size = a->cur->size * 2;
+        c = malloc(sizeof(*c) + size);
+        if (!c) {
+            perror("malloc");
+            exit(1);
+        }
+        c->size = size;
+        c->used = 0;
+        c->next = NULL;
+        a->reserved += size;
+        a->nchunks++;
+        // hinten anhängen, damit Reset alle Chunks wiederverwendet
+        if (!a->head) {
+            a->head = c;
+        } else {
+            struct arena_chunk *t = a->cur ? a->cur : a->head;
+            while (t->next) t = t->next;
+            t->next = c;
+        }
     }
-    args[i] = NULL;
-    return i;
+    a->cur = c;
+    void *p = c->data + c->used;
+    c->used += n;
+    a->used += n;
+    if (a->used > a->high_water)
+        a->high_water = a->used;
+    return p;
 }
 
-// Prüft, ob Prozess im Hintergrund laufen soll ("&")
-int is_background(char *args[], int argc) {
-    if (argc > 0 && strcmp(args[argc - 1], "&") == 0) {
-        args[argc - 1] = NULL;
-        return 1;
+// O(1) pro Chunk; die Chunks bleiben für die nächste Zeile erhalten
+static void arena_reset(struct arena *a) {
+    for (struct arena_chunk *c = a->head; c; c = c->next)
+        c->used = 0;
+    a->cur = a->head;
+    a->used = 0;
+    a->resets++;
+}
+
+static char *arena_strdup(struct arena *a, const char *s) {
+    size_t n = strlen(s) + 1;
+    char *d = arena_alloc(a, n);
+    memcpy(d, s, n);
+    return d;
+}
+
+// Token-Array in der Arena; wächst durch Verdoppeln (altes Array bleibt bis zum Reset liegen)
+static struct token *tok_push(struct arena *a, struct token **toks, int *n, int *cap) {
+    if (*n == *cap) {
+        int ncap = *cap ? *cap * 2 : 16;
+        struct token *t = arena_alloc(a, (size_t)ncap * sizeof(*t));
+        if (*n) memcpy(t, *toks, (size_t)*n * sizeof(*t));
+        *toks = t;
+        *cap = ncap;
     }
-    return 0;
+    struct token *t = &(*toks)[(*n)++];
+    t->text = NULL;
+    t->fd = -1;
+    t->status = 0;
+    return t;
 }
 
-// Built-In-Befehle
-int run_builtin(char *args[]) {
-    if (strcmp(args[0], "pwd") == 0) {
-        char cwd[512];
-        if (getcwd(cwd, sizeof(cwd)) != NULL)
-            printf("%s\n", cwd);
-        else
-            perror("pwd");
-        return 1;
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static int is_operator(char c) {
+    return c == '|' || c == '&' || c == '<' || c == '>' || c == ';';
+}
+
+// Zerlegt eine Befehlszeile in einem Durchlauf in Tokens (Lexer).
+// Quotes ('...', "...") und Backslash-Escapes werden an Ort und Stelle im
+// Zeilenpuffer entfernt, Wörter sind Zeiger in diesen Puffer. '#' am
+// Wortanfang leitet einen Kommentar ein; $? wird (außer in '...') zu STATUS_MARK.
+// Rückgabe: Anzahl Tokens, -1 bei Syntaxfehler.
+int parse_line(char *line, struct arena *a, struct token **out) {
+    struct token *toks = NULL;
+    int n = 0, cap = 0;
+    char *r = line;            // Lesezeiger
+    char *w = line;            // Schreibzeiger (w <= r)
+    char *word = NULL;         // Beginn des aktuellen Worts
+    int word_off = 0;          // dessen Position im Original
+    int word_status = 0;       // Wort enthält $?
+    int digits_only = 0;       // Wort besteht nur aus unquotierten Ziffern (IO-Nummer)
+
+    for (;;) {
+        char c = *r;
+        if (c == '\0' || is_blank(c) || is_operator(c) || (c == '#' && !word)) {
+            int io_fd = -1;
+            if (word) {
+                if ((c == '<' || c == '>') && digits_only) {
+                    *w = '\0';
+                    io_fd = atoi(word);   // z.B. "2>"
+                } else {
+                    *w++ = '\0';
+                    struct token *t = tok_push(a, &toks, &n, &cap);
+                    t->text = word;
+                    t->type = TOK_WORD;
+                    t->status = word_status;
+                    t->off = word_off;
+                    t->end = (int)(r - line);
+                }
+                word = NULL;
+            }
+            if (c == '\0' || c == '#')
+                break;
+            if (is_blank(c)) {
+                r++;
+                continue;
+            }
+
+            // Operator (c ist gesichert, r[1] wurde noch nicht überschrieben)
+            struct token *t = tok_push(a, &toks, &n, &cap);
+            t->fd = io_fd;
+            t->off = (int)(r - line);
+            if (c == '|' && r[1] == '|') {
+                t->type = TOK_OR;
+                r++;
+            } else if (c == '|') {
+                t->type = TOK_PIPE;
+            } else if (c == '&' && r[1] == '&') {
+                t->type = TOK_AND;
+                r++;
+            } else if (c == '&') {
+                t->type = TOK_AMP;
+            } else if (c == ';') {
+                t->type = TOK_SEMI;
+            } else if (c == '<' && r[1] == '<' && r[2] == '<') {
+                t->type = TOK_HERESTR;
+                r += 2;
+            } else if ((c == '<' || c == '>') && r[1] == '&') {
+                t->type = TOK_REDIR_DUP;
+                if (t->fd < 0) t->fd = (c == '<') ? STDIN_FILENO : STDOUT_FILENO;
+                r++;
+            } else if (c == '<') {
+                t->type = TOK_REDIR_IN;
+            } else if (r[1] == '>') {
+                t->type = TOK_REDIR_APPEND;
+                r++;
+            } else {
+                t->type = TOK_REDIR_OUT;
+            }
+            r++;
+            t->end = (int)(r - line);
+            w = r;
+            continue;
+        }
+
+        if (!word) {
+            word = w;
+            word_off = (int)(r - line);
+            word_status = 0;
+            digits_only = 1;
+        }
+
+        if (c == '$' && r[1] == '?') {
+            *w++ = STATUS_MARK;
+            r += 2;
+            word_status = 1;
+            digits_only = 0;
+            continue;
+        }
+
+        if (c == '\'') {
+            r++;
+            while (*r && *r != '\'')
+                *w++ = *r++;
+            if (!*r) {
+                fprintf(stderr, "Syntaxfehler: fehlendes '\n");
+                return -1;
+            }
+            r++;
+            digits_only = 0;
+        } else if (c == '"') {
+            r++;
+            while (*r && *r != '"') {
+                if (*r == '$' && r[1] == '?') {
+                    *w++ = STATUS_MARK;
+                    r += 2;
+                    word_status = 1;
+                    continue;
+                }
+                if (*r == '\\' && r[1] && strchr("\"\\$`", r[1]))
+                    r++;
+                *w++ = *r++;
+            }
+            if (!*r) {
+                fprintf(stderr, "Syntaxfehler: fehlendes \"\n");
+                return -1;
+            }
+            r++;
+            digits_only = 0;
+        } else if (c == '\\') {
+            r++;
+            if (*r)
+                *w++ = *r++;
+            digits_only = 0;
+        } else {
+            if (c < '0' || c > '9')
+                digits_only = 0;
+            *w++ = *r++;
+        }
     }
 
-    if (strcmp(args[0], "cd") == 0) {
-        if (args[1] == NULL)
-            fprintf(stderr, "cd: Pfad fehlt\n");
-        else if (chdir(args[1]) != 0)
-            perror("cd");
-        return 1;
+    *out = toks;
+    return n;
+}
+
+// "0-3,6" -> cpu_set_t
+static int parse_cpulist(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s) {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s || lo < 0) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo) return -1;
+        }
+        if (hi >= CPU_SETSIZE) return -1;
+        for (long c = lo; c <= hi; c++)
+            CPU_SET((int)c, set);
+        if (*end == ',') end++;
+        else if (*end) return -1;
+        s = end;
+    }
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+// "idle", "be[:n]", "rt[:n]" oder "klasse:n" (1=rt, 2=be, 3=idle), n = 0..7
+#define IOPRIO_CLASS_SHIFT 13
+static int parse_ioprio(const char *s) {
+    int cls, level = 4;
+    const char *colon = strchr(s, ':');
+    size_t len = colon ? (size_t)(colon - s) : strlen(s);
+    if      (len == 2 && strncmp(s, "rt", 2) == 0)   cls = 1;
+    else if (len == 2 && strncmp(s, "be", 2) == 0)   cls = 2;
+    else if (len == 4 && strncmp(s, "idle", 4) == 0) cls = 3;
+    else if (len == 1 && s[0] >= '1' && s[0] <= '3') cls = s[0] - '0';
+    else return -1;
+    if (cls == 3) level = 0;
+    if (colon) {
+        if (colon[1] < '0' || colon[1] > '7' || colon[2] != '\0') return -1;
+        level = colon[1] - '0';
+    }
+    return (cls << IOPRIO_CLASS_SHIFT) | level;
+}
+
+// Wurzel der cgroup-v2-Hierarchie: /sys/fs/cgroup, bei Hybrid-Systemen
+// (v1-Controller daneben) /sys/fs/cgroup/unified
+static const char *cg2_root(void) {
+    static const char *root;
+    if (!root)
+        root = access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0 ||
+               access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK) != 0
+             ? "/sys/fs/cgroup" : "/sys/fs/cgroup/unified";
+    return root;
+}
+
+// Ressourcen für "limit"; Größen in Bytes, der Rest als Anzahl bzw. Sekunden
+static const struct {
+    const char *name;
+    int resource;
+} g_rlimit_names[] = {
+    { "as",      RLIMIT_AS },      { "core",   RLIMIT_CORE },
+    { "cpu",     RLIMIT_CPU },     { "data",   RLIMIT_DATA },
+    { "fsize",   RLIMIT_FSIZE },   { "memlock", RLIMIT_MEMLOCK },
+    { "nofile",  RLIMIT_NOFILE },  { "nproc",  RLIMIT_NPROC },
+    { "stack",   RLIMIT_STACK },
+};
+
+// "cpu=10,as=2G,nofile=256": Zahl mit optionalem K/M/G/T (×1024) oder "unlimited"
+static int parse_rlimits(const char *spec, struct sched_prefs *sp) {
+    const char *s = spec;
+    while (*s) {
+        const char *eq = strchr(s, '=');
+        if (!eq) return -1;
+        size_t len = (size_t)(eq - s);
+        int res = -1;
+        for (size_t i = 0; i < sizeof(g_rlimit_names) / sizeof(g_rlimit_names[0]); i++)
+            if (strlen(g_rlimit_names[i].name) == len && strncmp(s, g_rlimit_names[i].name, len) == 0)
+                res = g_rlimit_names[i].resource;
+        if (res < 0) return -1;
+
+        rlim_t val;
+        const char *end = eq + 1;
+        if (strncmp(end, "unlimited", 9) == 0) {
+            val = RLIM_INFINITY;
+            end += 9;
+        } else {
+            if (!isdigit((unsigned char)*end)) return -1;
+            errno = 0;
+            char *e;
+            unsigned long long v = strtoull(end, &e, 10);
+            if (errno) return -1;
+            int shift = 0;
+            switch (*e) {
+                case 'K': case 'k': shift = 10; e++; break;
+                case 'M': case 'm': shift = 20; e++; break;
+                case 'G': case 'g': shift = 30; e++; break;
+                case 'T': case 't': shift = 40; e++; break;
+            }
+            if (shift && v > (~0ull >> shift)) return -1;
+            val = (rlim_t)(v << shift);
+            end = e;
+        }
+        if (*end != ',' && *end != '\0') return -1;
+
+        // Derselbe Wert nochmal: der letzte gilt
+        int k = 0;
+        while (k < sp->nlimits && sp->limits[k].resource != res)
+            k++;
+        if (k == MAX_RLIMITS) return -1;
+        if (k == sp->nlimits) sp->nlimits++;
+        sp->limits[k].resource = res;
+        sp->limits[k].value = val;
+        s = *end ? end + 1 : end;
     }
+    return 0;
+}
 
-    if (strcmp(args[0], "exit") == 0) {
-        char ans[8];
-        printf("Shell wirklich beenden? (y/n): ");
-        if (fgets(ans, sizeof(ans), stdin) && ans[0] == 'y') {
-            printf("Shell wird beendet.\n");
-            exit(0);
+// Präfixe am Anfang einer Stufe abtrennen, z.B. "pin 0-3 nice -n 5 batch make".
+// Allein bleibt das Wort ein Kommando; mit Argumenten, aber ohne Kommando ist es ein Fehler.
+static int parse_sched_prefixes(struct command *cmd, struct arena *a) {
+    for (;;) {
+        char **v = cmd->argv;
+        int n = 0;                  // Anzahl Wörter des Präfixes
+        if (strcmp(v[0], "nice") == 0)
+            n = cmd->argc >= 2 && strcmp(v[1], "-n") == 0 ? 3 : 1;
+        else if (strcmp(v[0], "batch") == 0 || strcmp(v[0], "idle") == 0)
+            n = 1;
+        else if (strcmp(v[0], "pin") == 0 || strcmp(v[0], "ioprio") == 0 ||
+                 strcmp(v[0], "cgroup") == 0 || strcmp(v[0], "limit") == 0)
+            n = 2;
+        if (n == 0 || cmd->argc == 1)
+            return 0;
+        if (cmd->argc <= n) {
+            fprintf(stderr, "%s: Befehl fehlt\n", v[0]);
+            return -1;
         }
-        return 1;
+
+        struct sched_prefs *sp = cmd->sched;
+        if (!sp) {
+            sp = cmd->sched = arena_alloc(a, sizeof(*sp));
+            memset(sp, 0, sizeof(*sp));
+            sp->policy = -1;
+            sp->ioprio = -1;
+        }
+        if (v[0][0] == 'p') {
+            if (parse_cpulist(v[1], &sp->cpus) != 0) {
+                fprintf(stderr, "pin: ungültige CPU-Liste '%s'\n", v[1]);
+                return -1;
+            }
+            sp->has_affinity = 1;
+        } else if (strcmp(v[0], "nice") == 0) {
+            char *end;
+            long inc = n == 3 ? strtol(v[2], &end, 10) : 10;
+            if (n == 3 && (*end != '\0' || inc < -40 || inc > 40)) {
+                fprintf(stderr, "nice: ungültiger Wert '%s'\n", v[2]);
+                return -1;
+            }
+            sp->has_nice = 1;
+            sp->nice = (int)inc;
+        } else if (strcmp(v[0], "batch") == 0) {
+            sp->policy = SCHED_BATCH;
+        } else if (strcmp(v[0], "idle") == 0) {
+            sp->policy = SCHED_IDLE;
+        } else if (strcmp(v[0], "ioprio") == 0) {
+            if ((sp->ioprio = parse_ioprio(v[1])) < 0) {
+                fprintf(stderr, "ioprio: ungültige Klasse '%s' (idle, be[:0-7], rt[:0-7])\n", v[1]);
+                return -1;
+            }
+        } else if (strcmp(v[0], "limit") == 0) {
+            if (parse_rlimits(v[1], sp) != 0) {
+                fprintf(stderr, "limit: ungültige Grenze '%s' (z.B. cpu=10,as=2G,nofile=256)\n", v[1]);
+                return -1;
+            }
+        } else {
+            // cgroup v2: relativ zur Wurzel der Hierarchie
+            const char *dir = v[1];
+            const char *base = dir[0] == '/' ? "" : cg2_root();
+            size_t len = strlen(base) + 1 + strlen(dir) + sizeof("/cgroup.procs");
+            char *path = arena_alloc(a, len);
+            snprintf(path, len, "%s%s%s/cgroup.procs", base, *base ? "/" : "", dir);
+            sp->cgroup_procs = path;
+        }
+        cmd->argv += n;
+        cmd->argc -= n;
     }
+}
 
+// Nur SCHED_BATCH/SCHED_IDLE kann posix_spawn selbst setzen
+static int sched_needs_fork(const struct sched_prefs *sp) {
+    return sp->has_affinity || sp->has_nice || sp->ioprio >= 0 || sp->cgroup_procs ||
+           sp->nlimits;
+}
+
+// Aufrufenden Prozess in eine cgroup verschieben; Rückgabe 0 oder errno
+static int cgroup_join(const char *procs) {
+    int fd = open(procs, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    ssize_t w = write(fd, "0\n", 2);   // "0" = der schreibende Prozess
+    int err = w == 2 ? 0 : errno;
+    close(fd);
+    return err;
+}
+
+// Im Kind zwischen fork und exec; Rückgabe 0 oder errno
+static int sched_apply_child(const struct sched_prefs *sp) {
+    int err;
+    if (sp->cgroup_procs && (err = cgroup_join(sp->cgroup_procs)) != 0)
+        return err;
+    for (int i = 0; i < sp->nlimits; i++) {
+        struct rlimit rl = { sp->limits[i].value, sp->limits[i].value };
+        if (setrlimit(sp->limits[i].resource, &rl) != 0)
+            return errno;
+    }
+    if (sp->has_affinity && sched_setaffinity(0, sizeof(sp->cpus), &sp->cpus) != 0)
+        return errno;
+    if (sp->has_nice) {
+        errno = 0;
+        if (nice(sp->nice) == -1 && errno != 0)
+            return errno;
+    }
+    if (sp->policy >= 0) {
+        struct sched_param prm = { .sched_priority = 0 };
+        if (sched_setscheduler(0, sp->policy, &prm) != 0)
+            return errno;
+    }
+    if (sp->ioprio >= 0 && syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, sp->ioprio) != 0)
+        return errno;
     return 0;
 }
 
-// Prozess starten (Foreground / Background)
-void run_process(char *args[], int background) {
+// Baut aus den Tokens den Syntaxbaum (Pipeline aus Kommandos mit Umlenkungen).
+// Rückgabe NULL bei Syntaxfehler (Meldung wurde ausgegeben).
+// toks enthält nur Wörter, Umlenkungen und '|' (die Listen-Operatoren trennt parse_command)
+static struct pipeline *parse_pipeline(struct token *toks, int ntoks, int background,
+                                       char *text, struct arena *a) {
+    int ncmds = 1, has_status = 0;
+    for (int i = 0; i < ntoks; i++) {
+        if (toks[i].type == TOK_PIPE)
+            ncmds++;
+        has_status |= toks[i].status;
+    }
+
+    struct pipeline *pl = arena_alloc(a, sizeof(*pl));
+    pl->ncmds = ncmds;
+    pl->cmds = arena_alloc(a, (size_t)ncmds * sizeof(*pl->cmds));
+    pl->background = background;
+    pl->timed = 0;
+    pl->has_status = has_status;
+    pl->text = text;
+    pl->op = LIST_SEQ;
+    pl->next = NULL;
+
+    int start = 0;
+    for (int c = 0; c < ncmds; c++) {
+        int end = start;
+        int nwords = 0;
+        while (end < ntoks && toks[end].type != TOK_PIPE) {
+            if (toks[end].type == TOK_WORD) nwords++;
+            end++;
+        }
+
+        struct command *cmd = &pl->cmds[c];
+        cmd->argv = arena_alloc(a, (size_t)(nwords + 1) * sizeof(*cmd->argv));
+        cmd->argc = 0;
+        cmd->redirs = NULL;
+        struct redir **tail = &cmd->redirs;
+
+        for (int i = start; i < end; i++) {
+            if (toks[i].type == TOK_WORD) {
+                cmd->argv[cmd->argc++] = toks[i].text;
+                continue;
+            }
+            // Umlenkung: das nächste Token muss ein Wort sein
+            if (i + 1 >= end || toks[i + 1].type != TOK_WORD) {
+                fprintf(stderr, "Syntaxfehler: Dateiname nach Umlenkung fehlt\n");
+                return NULL;
+            }
+            struct redir *r = arena_alloc(a, sizeof(*r));
+            r->type = toks[i].type;
+            int is_in = toks[i].type == TOK_REDIR_IN || toks[i].type == TOK_HERESTR;
+            r->fd = toks[i].fd >= 0 ? toks[i].fd : (is_in ? STDIN_FILENO : STDOUT_FILENO);
+            r->target = toks[i + 1].text;
+            r->next = NULL;
+            *tail = r;
+            tail = &r->next;
+            i++;       // Dateiname überspringen
+        }
+        cmd->argv[cmd->argc] = NULL;
+
+        // "time" vor der ersten Stufe gilt für die ganze Pipeline
+        if (c == 0 && cmd->argc > 1 && strcmp(cmd->argv[0], "time") == 0) {
+            pl->timed = 1;
+            cmd->argv++;
+            cmd->argc--;
+        }
+
+        cmd->sched = NULL;
+        if (parse_sched_prefixes(cmd, a) != 0)
+            return NULL;
+
+        if (cmd->argc == 0) {
+            fprintf(stderr, "Fehlerhafte Pipe-Syntax.\n");
+            return NULL;
+        }
+        start = end + 1;
+    }
+    return pl;
+}
+
+static int is_list_op(enum tok_type t) {
+    return t == TOK_SEMI || t == TOK_AMP || t == TOK_AND || t == TOK_OR;
+}
+
+static const char *list_op_name(enum tok_type t) {
+    switch (t) {
+        case TOK_SEMI: return ";";
+        case TOK_AMP:  return "&";
+        case TOK_AND:  return "&&";
+        default:       return "||";
+    }
+}
+
+// Zeile (wird in place zerlegt) in eine Kommandoliste übersetzen: Pipelines, getrennt
+// durch ';', '&' (die Pipeline davor läuft im Hintergrund), '&&' und '||', verkettet
+// über pl->next. text ist der Originaltext; jede Pipeline bekommt ihren Teil davon
+// für die Jobtabelle. Die ganze Zeile wird geprüft, bevor etwas läuft.
+// NULL bei leerer Zeile oder Syntaxfehler (dann g_last_status = 2).
+static struct pipeline *parse_command(char *line, char *text, struct arena *a) {
+    TRACE(parse_begin, text, strlen(text));
+    struct token *toks;
+    int ntoks = parse_line(line, a, &toks);
+    if (ntoks < 0)
+        goto fail;
+
+    struct pipeline *head = NULL, **tail = &head;
+    enum list_op op = LIST_SEQ;
+    int start = 0, npl = 0;
+    for (int i = 0; i <= ntoks; i++) {
+        if (i < ntoks && !is_list_op(toks[i].type))
+            continue;
+        if (i == start) {
+            if (i == ntoks && op == LIST_SEQ)
+                break;   // leere Zeile oder abschließendes ';' / '&'
+            if (i == ntoks)
+                fprintf(stderr, "Syntaxfehler: Kommando nach '%s' fehlt\n", list_op_name(toks[i - 1].type));
+            else
+                fprintf(stderr, "Syntaxfehler: unerwartetes '%s'\n", list_op_name(toks[i].type));
+            goto fail;
+        }
+        int background = i < ntoks && toks[i].type == TOK_AMP;
+        int end = background ? toks[i].end : toks[i - 1].end;
+        int off = toks[start].off;
+        char *ptext = arena_alloc(a, (size_t)(end - off) + 1);
+        memcpy(ptext, text + off, (size_t)(end - off));
+        ptext[end - off] = '\0';
+
+        struct pipeline *pl = parse_pipeline(toks + start, i - start, background, ptext, a);
+        if (!pl)
+            goto fail;
+        npl++;
+        pl->op = op;
+        *tail = pl;
+        tail = &pl->next;
+        op = i == ntoks ? LIST_SEQ : toks[i].type == TOK_AND ? LIST_AND :
+             toks[i].type == TOK_OR ? LIST_OR : LIST_SEQ;
+        start = i + 1;
+    }
+    TRACE(parse_end, (const char *)NULL, npl);
+    return head;
+
+fail:
+    g_last_status = 2;
+    TRACE(parse_end, (const char *)NULL, -1);
+    return NULL;
+}
+
+// Monotone Zeit in Nanosekunden
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static void spawn_stat_add(enum spawn_engine e, unsigned long long ns) {
+    struct spawn_stat *st = &g_spawn_stats[e];
+    if (st->count == 0 || ns < st->min_ns) st->min_ns = ns;
+    if (ns > st->max_ns) st->max_ns = ns;
+    st->total_ns += ns;
+    st->count++;
+}
+
+// FNV-1a
+static unsigned hash_name(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h % HASH_BUCKETS;
+}
+
+static void hash_clear(void) {
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        struct hash_entry *e = g_hash[i];
+        while (e) {
+            struct hash_entry *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        g_hash[i] = NULL;
+    }
+}
+
+static void hash_forget(const char *name) {
+    struct hash_entry **pp = &g_hash[hash_name(name)];
+    while (*pp) {
+        struct hash_entry *e = *pp;
+        if (strcmp(e->name, name) == 0) {
+            *pp = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            return;
+        }
+        pp = &e->next;
+    }
+}
+
+// Sucht name in den PATH-Verzeichnissen (leerer Eintrag = aktuelles Verzeichnis)
+static char *path_resolve(const char *name, const char *path_env) {
+    size_t nlen = strlen(name);
+    const char *dir = path_env;
+    while (dir) {
+        const char *colon = strchr(dir, ':');
+        size_t dlen = colon ? (size_t)(colon - dir) : strlen(dir);
+        char *full = malloc(dlen + nlen + 3);
+        if (!full)
+            return NULL;
+        if (dlen == 0) {
+            memcpy(full, "./", 2);
+            dlen = 2;
+        } else {
+            memcpy(full, dir, dlen);
+            full[dlen++] = '/';
+        }
+        memcpy(full + dlen, name, nlen + 1);
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0)
+            return full;
+        free(full);
+        dir = colon ? colon + 1 : NULL;
+    }
+    return NULL;
+}
+
+// Liefert den Pfad für name (aus dem Cache oder frisch aufgelöst) oder NULL.
+// *cached = 1, wenn der Eintrag bereits im Cache stand.
+static const char *path_lookup(const char *name, int *cached) {
+    *cached = 0;
+    if (strchr(name, '/'))
+        return name;
+
+    // PATH geändert -> Cache verwerfen
+    const char *path_env = getenv("PATH");
+    if (!path_env) path_env = "/usr/local/bin:/usr/bin:/bin";
+    if (!g_hash_path_env || strcmp(g_hash_path_env, path_env) != 0) {
+        hash_clear();
+        free(g_hash_path_env);
+        g_hash_path_env = strdup(path_env);
+    }
+
+    unsigned b = hash_name(name);
+    for (struct hash_entry *e = g_hash[b]; e; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            e->hits++;
+            *cached = 1;
+            return e->path;
+        }
+    }
+
+    char *full = path_resolve(name, path_env);
+    if (!full)
+        return NULL;
+    struct hash_entry *e = malloc(sizeof(*e));
+    if (!e || !(e->name = strdup(name))) {
+        free(e);
+        free(full);
+        return NULL;
+    }
+    e->path = full;
+    e->hits = 1;
+    e->next = g_hash[b];
+    g_hash[b] = e;
+    return full;
+}
+
+// Built-In-Befehle
+int run_builtin(char *args[]) {
+    const struct builtin *b = builtin_find(args[0]);
+    if (!b)
+        return 0;
+    TRACE(builtin_begin, args[0], 0);
+    g_last_status = b->fn(args);
+    TRACE(builtin_end, args[0], g_last_status);
+    return 1;
+}
+
+// Fehler, die aus execve im Kind stammen (Programm fehlt, keine Rechte, ...).
+// Bei allen anderen posix_spawn-Fehlern wird auf fork zurückgefallen.
+static int is_exec_error(int err) {
+    return err == ENOENT || err == EACCES || err == ENOEXEC || err == ENOTDIR ||
+           err == ELOOP || err == ENAMETOOLONG || err == E2BIG || err == ETXTBSY;
+}
+
+// fork + execv; Exec-Fehler kommen über eine CLOEXEC-Pipe zurück,
+// damit beide Engines dieselbe Semantik (und vergleichbare Latenz) haben.
+// Mit o->builtin läuft statt execv das Built-In im Kind (path ist dann NULL).
+static int spawn_fork(pid_t *out_pid, const char *path, char *args[],
+                      const struct spawn_opts *o) {
+    int errpipe[2];
+    if (pipe2(errpipe, O_CLOEXEC) == -1)
+        return errno;
+
     pid_t pid = fork();
     if (pid < 0) {
-        perror("fork");
-        return;
+        int err = errno;
+        close(errpipe[0]);
+        close(errpipe[1]);
+        return err;
     }
 
     if (pid == 0) {
         // Kindprozess
-        execvp(args[0], args);
-        perror("execvp");
-        exit(1);
-    } else {
-        // Elternprozess
-        printf("[PID %d] gestartet%s\n", pid, background ? " (Hintergrund)" : "");
-        if (!background) {
-            int status;
-            waitpid(pid, &status, 0);
+        close(errpipe[0]);
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        if (o->pgid >= 0) {
+            setpgid(0, o->pgid);
+            if (o->foreground)
+                tcsetpgrp(STDIN_FILENO, getpgrp());
+            signal(SIGTTOU, SIG_DFL);
+            signal(SIGTTIN, SIG_DFL);
+        }
+        if (o->in_fd >= 0 && o->in_fd != STDIN_FILENO)    dup2(o->in_fd, STDIN_FILENO);
+        if (o->out_fd >= 0 && o->out_fd != STDOUT_FILENO) dup2(o->out_fd, STDOUT_FILENO);
+        for (int i = 0; i < o->nclose; i++)
+            close(o->close_fds[i]);
+        for (int i = 0; i < o->nmaps; i++)
+            if (o->maps[i].from != o->maps[i].to)
+                dup2(o->maps[i].from, o->maps[i].to);
+        int err = o->cgroup_procs ? cgroup_join(o->cgroup_procs) : 0;
+        if (err == 0 && o->sched)
+            err = sched_apply_child(o->sched);
+        if (err == 0 && o->builtin) {
+            // Built-In als Stufe: Fehlerpipe sofort schließen, damit der Elternprozess
+            // nicht auf das Ende wartet; der Rückgabewert wird zum Exit-Status
+            close(errpipe[1]);
+            g_stage_child = 1;
+            int st = o->builtin(args);
+            fflush(stdout);
+            fflush(stderr);
+            _exit(st);
         }
+        if (err == 0) {
+            execv(path, args);
+            err = errno;
+        }
+        ssize_t w = write(errpipe[1], &err, sizeof(err));
+        (void)w;
+        _exit(127);
     }
-}
 
-// Zwei Prozesse mit Pipe verbinden (cmd1 | cmd2)
-void run_pipe(char *left[], char *right[]) {
-    int fd[2];
-    if (pipe(fd) == -1) {
-        perror("pipe");
-        return;
-    }
+    // Elternprozess: Gruppe auch hier setzen (Race mit dem Kind vermeiden)
+    if (o->pgid >= 0)
+        setpgid(pid, o->pgid ? o->pgid : pid);
 
-    pid_t pid1 = fork();
-    if (pid1 < 0) {
-        perror("fork");
-        return;
+    // EOF auf der Pipe = exec erfolgreich
+    close(errpipe[1]);
+    int child_err = 0;
+    ssize_t n;
+    do {
+        n = read(errpipe[0], &child_err, sizeof(child_err));
+    } while (n < 0 && errno == EINTR);
+    close(errpipe[0]);
+
+    if (n == (ssize_t)sizeof(child_err)) {
+        waitpid(pid, NULL, 0);
+        return child_err;
     }
+    *out_pid = pid;
+    return 0;
+}
 
-    if (pid1 == 0) {
-        // Kind 1 (Producer)
-        dup2(fd[1], STDOUT_FILENO);
-        close(fd[0]);
-        close(fd[1]);
-        execvp(left[0], left);
-        perror("execvp left");
-        exit(1);
+static int spawn_posix(pid_t *out_pid, const char *path, char *args[],
+                       const struct spawn_opts *o) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t empty, dfl;
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    int err;
+
+    if ((err = posix_spawn_file_actions_init(&fa)) != 0)
+        return err;
+    if ((err = posix_spawnattr_init(&attr)) != 0) {
+        posix_spawn_file_actions_destroy(&fa);
+        return err;
     }
 
-    pid_t pid2 = fork();
-    if (pid2 < 0) {
-        perror("fork");
-        return;
+    // Eigene Prozessgruppe; Terminal übernehmen, bevor stdin umgelenkt wird
+    if (o->pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+        err = posix_spawnattr_setpgroup(&attr, o->pgid);
+        sigemptyset(&dfl);
+        sigaddset(&dfl, SIGTTOU);
+        sigaddset(&dfl, SIGTTIN);
+        if (err == 0) err = posix_spawnattr_setsigdefault(&attr, &dfl);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+        if (o->foreground && err == 0)
+            err = posix_spawn_file_actions_addtcsetpgrp_np(&fa, STDIN_FILENO);
+#endif
     }
 
-    if (pid2 == 0) {
-        // Kind 2 (Consumer)
-        dup2(fd[0], STDIN_FILENO);
-        close(fd[0]);
-        close(fd[1]);
-        execvp(right[0], right);
-        perror("execvp right");
-        exit(1);
+    if (o->in_fd >= 0 && o->in_fd != STDIN_FILENO && err == 0)
+        err = posix_spawn_file_actions_adddup2(&fa, o->in_fd, STDIN_FILENO);
+    if (o->out_fd >= 0 && o->out_fd != STDOUT_FILENO && err == 0)
+        err = posix_spawn_file_actions_adddup2(&fa, o->out_fd, STDOUT_FILENO);
+    for (int i = 0; i < o->nclose && err == 0; i++)
+        err = posix_spawn_file_actions_addclose(&fa, o->close_fds[i]);
+    for (int i = 0; i < o->nmaps && err == 0; i++)
+        if (o->maps[i].from != o->maps[i].to)
+            err = posix_spawn_file_actions_adddup2(&fa, o->maps[i].from, o->maps[i].to);
+
+    // batch/idle: Scheduling-Klasse setzt posix_spawn selbst
+    if (o->sched && o->sched->policy >= 0 && err == 0) {
+        struct sched_param prm = { .sched_priority = 0 };
+        flags |= POSIX_SPAWN_SETSCHEDULER;
+        err = posix_spawnattr_setschedpolicy(&attr, o->sched->policy);
+        if (err == 0) err = posix_spawnattr_setschedparam(&attr, &prm);
     }
 
-    // Elternprozess
-    close(fd[0]);
-    close(fd[1]);
-    printf("[Pipe] Prozesse %d → %d gestartet\n", pid1, pid2);
+    // Kind startet mit leerer Signalmaske
+    sigemptyset(&empty);
+    if (err == 0) err = posix_spawnattr_setsigmask(&attr, &empty);
+    if (err == 0) err = posix_spawnattr_setflags(&attr, flags);
 
-    int status;
-    waitpid(pid1, &status, 0);
-    waitpid(pid2, &status, 0);
-}
+    if (err == 0)
+        err = posix_spawn(out_pid, path, &fa, &attr, args, environ);
 
-// Hauptprogramm
-int main(void) {
-    // Signalbehandlung aktivieren
-    signal(SIGINT, signal_handler);
-    signal(SIGTSTP, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGCONT, signal_handler);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    return err;
+}
 
-    // MQ/ Pthread-Add-on -> Versuchen, die MQ zu öffnen und Listener zu starten
-    mq_start_if_available();
+// Startet args[0] mit den Optionen aus o (Umlenkung, Prozessgruppe).
+// Rückgabe: PID des Kindes oder -1 (Fehlermeldung wurde bereits ausgegeben).
+static pid_t spawn_cmd(char *args[], const struct spawn_opts *o) {
+    enum spawn_engine used;
+    pid_t pid = -1;
+    unsigned long long t0 = now_ns();
+    int err, cached;
 
-    char line[MAX_LINE];
-    char *args[MAX_ARGS];
-    char cwd[256];
+    // Gepufferte Ausgabe der Shell vor die des Kindes
+    fflush(stdout);
 
-    printf("Willkommen in der Mini-Shell (mit Signals, Background & Pipes)\n");
+    // Built-In als Stufe: nichts aufzulösen, nur fork
+    if (o->builtin) {
+        used = SPAWN_FORK;
+        TRACE(spawn_begin, args[0], used);
+        err = spawn_fork(&pid, NULL, args, o);
+        goto done;
+    }
 
-    while (1) {
-        // Prompt: Pfad + CPU-Last
-        int load_snapshot;
-        pthread_mutex_lock(&g_cpu_mtx);
-        load_snapshot = current_cpu_load; // -1 = n/a
-        pthread_mutex_unlock(&g_cpu_mtx);
-
-        if (getcwd(cwd, sizeof(cwd)) != NULL) {
-            if (load_snapshot >= 0) printf("%s [CPU %d%%]> ", cwd, load_snapshot);
-            else                    printf("%s [CPU n/a]> ",   cwd);
-        } else {
-            if (load_snapshot >= 0) printf("sh [CPU %d%%]> ", load_snapshot);
-            else                    printf("sh [CPU n/a]> ");
+    const char *path = path_lookup(args[0], &cached);
+    for (;;) {
+        TRACE(lookup, args[0], cached);
+        if (!path) {
+            fprintf(stderr, "%s: Kommando nicht gefunden\n", args[0]);
+            TRACE(spawn_end, args[0], -ENOENT);
+            return -1;
         }
-        fflush(stdout);
 
-        if (!fgets(line, sizeof(line), stdin))
-            break;
-        trim_newline(line);
+        used = g_spawn_engine;
+        // Affinität, nice, ioprio, cgroup, Limits gehen nur zwischen fork und exec
+        if (o->cgroup_procs || (o->sched && sched_needs_fork(o->sched)))
+            used = SPAWN_FORK;
+        TRACE(spawn_begin, args[0], used);
+        err = -1;
+        if (used == SPAWN_POSIX) {
+            err = spawn_posix(&pid, path, args, o);
+            if (err != 0 && !is_exec_error(err)) {
+                used = SPAWN_FORK;   // Fallback; der Fehlversuch zählt nicht zur Latenz
+                t0 = now_ns();
+            }
+        }
+        if (used == SPAWN_FORK)
+            err = spawn_fork(&pid, path, args, o);
 
-        if (strlen(line) == 0)
+        // Veralteter Cache-Eintrag (Programm verschoben/gelöscht) -> neu auflösen
+        if (err == ENOENT && cached) {
+            hash_forget(args[0]);
+            path = path_lookup(args[0], &cached);
             continue;
+        }
 
-        // Prüfen auf Pipe
-        char *pipe_pos = strchr(line, '|');
-        if (pipe_pos != NULL) {
-            *pipe_pos = '\0';
-            char *left_cmd = line;
-            char *right_cmd = pipe_pos + 1;
-            while (*right_cmd == ' ') right_cmd++;
-
-            char *left_args[MAX_ARGS];
-            char *right_args[MAX_ARGS];
-            parse_line(left_cmd, left_args);
-            parse_line(right_cmd, right_args);
-
-            if (left_args[0] && right_args[0])
-                run_pipe(left_args, right_args);
-            else
-                fprintf(stderr, "Fehlerhafte Pipe-Syntax.\n");
-            continue;
+        // Ausführbare Datei ohne #! (ENOEXEC): wie execvp über /bin/sh starten
+        if (err == ENOEXEC) {
+            size_t n = 0;
+            while (args[n]) n++;
+            char *sh_args[n + 2];
+            sh_args[0] = "/bin/sh";
+            sh_args[1] = (char *)path;
+            memcpy(&sh_args[2], &args[1], n * sizeof(*args));   // inkl. NULL
+            err = used == SPAWN_POSIX ? spawn_posix(&pid, "/bin/sh", sh_args, o)
+                                      : spawn_fork(&pid, "/bin/sh", sh_args, o);
         }
+        break;
+    }
 
-        // Normales Parsing
-        int argc = parse_line(line, args);
-        if (argc == 0)
-            continue;
+done:
+    TRACE(spawn_end, args[0], err ? -err : pid);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", args[0], strerror(err));
+        return -1;
+    }
 
-        // Built-In-Befehle
-        if (run_builtin(args))
-            continue;
+    g_last_spawn_ns = now_ns() - t0;
+    g_last_spawn_engine = used;
+    spawn_stat_add(used, g_last_spawn_ns);
+    return pid;
+}
+
+// Abgeschlossene Jobs mit Laufzeit (CLOCK_REALTIME, wie die cpuloadd-Historie),
+// damit cpuhist die Last während der letzten Jobs zeigen kann
+#define JOB_HIST_LEN 16
+struct job_hist {
+    int id;
+    char cmd[48];
+    unsigned long long start_rt, end_rt;   // ns
+};
+static struct job_hist g_job_hist[JOB_HIST_LEN];
+static unsigned g_job_hist_n = 0;           // insgesamt eingetragen
 
-        // Hintergrund prüfen
-        int background = is_background(args, argc);
+static unsigned long long realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+// Monotone Zeit (now_ns) in Wanduhrzeit umrechnen
+static unsigned long long mono_to_rt(unsigned long long mono) {
+    return mono + (realtime_ns() - now_ns());
+}
+
+static void job_hist_record(const struct job *j) {
+    struct job_hist *h = &g_job_hist[g_job_hist_n++ % JOB_HIST_LEN];
+    h->id = j->id;
+    snprintf(h->cmd, sizeof(h->cmd), "%s", j->cmd);
+    h->start_rt = mono_to_rt(j->start_ns);
+    h->end_rt = mono_to_rt(j->end_ns);
+}
+
+// Job-Tabelle
+static struct job *job_alloc(const char *cmd, int nprocs, int background) {
+    int max_id = 0;
+    struct job *slot = NULL;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (g_jobs[i].state == JOB_FREE) {
+            if (!slot) slot = &g_jobs[i];
+        } else if (g_jobs[i].id > max_id) {
+            max_id = g_jobs[i].id;
+        }
+    }
+    if (!slot) {
+        fprintf(stderr, "Jobtabelle voll (%d Jobs)\n", MAX_JOBS);
+        return NULL;
+    }
+    slot->procs = calloc((size_t)nprocs, sizeof(*slot->procs));
+    slot->cmd = strdup(cmd);
+    if (!slot->procs || !slot->cmd) {
+        free(slot->procs);
+        free(slot->cmd);
+        perror("malloc");
+        return NULL;
+    }
+    slot->id = max_id + 1;
+    slot->state = JOB_RUNNING;
+    slot->pgid = g_interactive ? 0 : -1;
+    slot->background = background;
+    slot->nprocs = 0;
+    slot->has_tmodes = 0;
+    slot->timed = g_timing_always;
+    slot->start_ns = now_ns();
+    slot->end_ns = 0;
+    return slot;
+}
 
-        // Externes Programm starten
-        run_process(args, background);
+// Leaf-cgroup für einen neuen Job anlegen; schlägt das fehl, wird jobcg mit
+// einer Meldung abgeschaltet statt bei jedem Kommando zu warnen
+static void jobcg_create(struct job *j) {
+    if (!g_jobcg_parent)
+        return;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/minishell-%d-%u", g_jobcg_parent, (int)getpid(),
+             ++g_jobcg_seq);
+    if (mkdir(path, 0755) != 0 || !(j->cg = strdup(path))) {
+        fprintf(stderr, "jobcg: %s: %s – abgeschaltet\n", path, strerror(errno));
+        rmdir(path);
+        free(g_jobcg_parent);
+        g_jobcg_parent = NULL;
     }
+}
+
+// Leaf entfernen; geht nicht, solange abgelöste Prozesse (Daemons) darin laufen
+static void jobcg_remove(struct job *j) {
+    if (!j->cg)
+        return;
+    if (rmdir(j->cg) != 0 && errno == EBUSY)
+        fprintf(stderr, "jobcg: %s bleibt bestehen (noch Prozesse darin)\n", j->cg);
+    free(j->cg);
+    j->cg = NULL;
+}
+
+static void job_free(struct job *j) {
+    if (j->state == JOB_DONE && j->nprocs > 0 && j->end_ns)
+        job_hist_record(j);
+    jobcg_remove(j);
+    free(j->procs);
+    free(j->cmd);
+    memset(j, 0, sizeof(*j));
+}
+
+// Neu gestarteten Prozess eintragen; der erste bestimmt die Prozessgruppe
+static void job_add_proc(struct job *j, pid_t pid) {
+    j->procs[j->nprocs].pid = pid;
+    j->procs[j->nprocs].state = JOB_RUNNING;
+    j->nprocs++;
+    if (j->pgid == 0)
+        j->pgid = pid;
+}
+
+static struct job *job_find_pid(pid_t pid) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (g_jobs[i].state == JOB_FREE) continue;
+        for (int k = 0; k < g_jobs[i].nprocs; k++)
+            if (g_jobs[i].procs[k].pid == pid)
+                return &g_jobs[i];
+    }
+    return NULL;
+}
+
+// "%n", "n" oder PID; ohne Argument der zuletzt angelegte Job
+static struct job *job_find_spec(const char *spec) {
+    if (spec == NULL) {
+        struct job *best = NULL;
+        for (int i = 0; i < MAX_JOBS; i++)
+            if (g_jobs[i].state != JOB_FREE && (!best || g_jobs[i].id > best->id))
+                best = &g_jobs[i];
+        return best;
+    }
+    char *end;
+    long n = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+    if (*end != '\0' || n <= 0)
+        return NULL;
+    for (int i = 0; i < MAX_JOBS; i++)
+        if (g_jobs[i].state != JOB_FREE && g_jobs[i].id == n)
+            return &g_jobs[i];
+    return spec[0] == '%' ? NULL : job_find_pid((pid_t)n);
+}
+
+static void job_update_state(struct job *j) {
+    int running = 0, stopped = 0;
+    for (int k = 0; k < j->nprocs; k++) {
+        if (j->procs[k].state == JOB_RUNNING) running++;
+        if (j->procs[k].state == JOB_STOPPED) stopped++;
+    }
+    if (running)      j->state = JOB_RUNNING;
+    else if (stopped) j->state = JOB_STOPPED;
+    else              j->state = JOB_DONE;
+    if (j->state == JOB_DONE && j->end_ns == 0)
+        j->end_ns = now_ns();
+}
+
+static double tv_sec(const struct timeval *tv) {
+    return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+
+static void print_rusage(const char *label, double real, const struct rusage *ru) {
+    fprintf(stderr, "%-10s real %.3fs  user %.3fs  sys %.3fs  maxrss %ld KB  "
+            "ctxsw %ld/%ld  faults %ld/%ld\n",
+            label, real, tv_sec(&ru->ru_utime), tv_sec(&ru->ru_stime), ru->ru_maxrss,
+            ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_majflt, ru->ru_minflt);
+}
+
+// Kleine Datei einer cgroup lesen (ein read); Rückgabe Länge oder -1
+static ssize_t cg_read(const char *dir, const char *file, char *buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+// Wert zu "schlüssel wert" in cpu.stat / memory.events
+static int cg_key(const char *buf, const char *key, unsigned long long *out) {
+    size_t len = strlen(key);
+    for (const char *p = buf; *p; ) {
+        if (strncmp(p, key, len) == 0 && p[len] == ' ') {
+            *out = strtoull(p + len + 1, NULL, 10);
+            return 0;
+        }
+        const char *nl = strchr(p, '\n');
+        if (!nl)
+            break;
+        p = nl + 1;
+    }
+    return -1;
+}
+
+// Verbrauch laut Job-cgroup: zählt alle Prozesse darin, auch Enkel, die wait4
+// nicht sieht (sh -c, make -j); memory.peak ist das Maximum der Summe, nicht
+// das größte maxrss einer Stufe
+static void job_print_cgroup(const struct job *j) {
+    char buf[1024];
+    unsigned long long usage = 0, user = 0, sys = 0, peak, oom;
+    if (cg_read(j->cg, "cpu.stat", buf, sizeof(buf)) < 0)
+        return;
+    cg_key(buf, "usage_usec", &usage);
+    cg_key(buf, "user_usec", &user);
+    cg_key(buf, "system_usec", &sys);
+    char mem[32] = "n/a";
+    if (cg_read(j->cg, "memory.peak", buf, sizeof(buf)) > 0) {
+        peak = strtoull(buf, NULL, 10);
+        snprintf(mem, sizeof(mem), "%llu KB", peak / 1024);
+    }
+    fprintf(stderr, "%-10s cpu %.3fs  user %.3fs  sys %.3fs  mem.peak %s",
+            "cgroup", (double)usage / 1e6, (double)user / 1e6, (double)sys / 1e6, mem);
+    if (cg_read(j->cg, "memory.events", buf, sizeof(buf)) > 0 &&
+        cg_key(buf, "oom_kill", &oom) == 0 && oom)
+        fprintf(stderr, "  oom_kill %llu", oom);
+    fputc('\n', stderr);
+}
+
+// Ressourcenbericht eines fertigen Jobs: je Stufe und (bei Pipelines) summiert
+// (maxrss = Maximum, ctxsw = freiwillig/unfreiwillig, faults = major/minor)
+static void job_print_times(const struct job *j) {
+    double real = (double)(j->end_ns - j->start_ns) / 1e9;
+    struct rusage sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int k = 0; k < j->nprocs; k++) {
+        const struct rusage *ru = &j->procs[k].ru;
+        if (j->nprocs > 1) {
+            char label[32];
+            snprintf(label, sizeof(label), "[%d]", j->procs[k].pid);
+            print_rusage(label, (double)(j->procs[k].end_ns - j->start_ns) / 1e9, ru);
+        }
+        timeradd(&sum.ru_utime, &ru->ru_utime, &sum.ru_utime);
+        timeradd(&sum.ru_stime, &ru->ru_stime, &sum.ru_stime);
+        if (ru->ru_maxrss > sum.ru_maxrss) sum.ru_maxrss = ru->ru_maxrss;
+        sum.ru_nvcsw  += ru->ru_nvcsw;
+        sum.ru_nivcsw += ru->ru_nivcsw;
+        sum.ru_majflt += ru->ru_majflt;
+        sum.ru_minflt += ru->ru_minflt;
+    }
+    print_rusage(j->nprocs > 1 ? "gesamt" : "time", real, &sum);
+    if (j->cg)
+        job_print_cgroup(j);
+}
+
+// SIGCHLD (über signalfd): alle Kinder per wait4(-1, WNOHANG) einsammeln
+// und die Jobtabelle aktualisieren (inkl. rusage je Prozess)
+static int par_reaped(pid_t pid, int status);
+
+static void reap_children(void) {
+    for (;;) {
+        int status;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru);
+        if (pid <= 0)
+            break;
+
+        struct job *j = job_find_pid(pid);
+        if (!j) {
+            par_reaped(pid, status);   // Kind von parallel (oder fehlgeschlagenes exec)
+            continue;
+        }
+        for (int k = 0; k < j->nprocs; k++) {
+            struct job_proc *p = &j->procs[k];
+            if (p->pid != pid) continue;
+            if (WIFSTOPPED(status))        p->state = JOB_STOPPED;
+            else if (WIFCONTINUED(status)) p->state = JOB_RUNNING;
+            else {
+                p->state = JOB_DONE;
+                p->status = status;
+                p->ru = ru;
+                p->end_ns = now_ns();
+            }
+        }
+        job_update_state(j);
+    }
+}
+
+// stdin nur dann im epoll-Set, wenn die Shell selbst lesen will
+static void stdin_arm(int want) {
+    if (!g_stdin_pollable || want == g_stdin_armed)
+        return;
+    struct epoll_event ev = { .events = want ? EPOLLIN : 0, .data.u32 = EV_STDIN };
+    epoll_ctl(g_epfd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+    g_stdin_armed = want;
+}
+
+// Eine Runde Event-Loop: wartet auf Signale, MQ-Nachrichten und (falls
+// want_stdin) Eingabe. Rückgabe 1, wenn stdin lesbar ist.
+static int g_admit_n;
+static void admit_dispatch(void);
+
+// Solange Jobs zurückgehalten werden, höchstens so lange schlafen
+#define ADMIT_POLL_MS 250
+
+static int event_wait(int want_stdin, int timeout_ms) {
+    if (want_stdin && !g_stdin_pollable)
+        return 1;   // z.B. Datei: read blockiert nie
+    stdin_arm(want_stdin);
+    if (g_admit_n > 0 && (timeout_ms < 0 || timeout_ms > ADMIT_POLL_MS))
+        timeout_ms = ADMIT_POLL_MS;
+
+    struct epoll_event evs[8];
+    int n = epoll_wait(g_epfd, evs, 8, timeout_ms);
+    if (n < 0) {
+        if (errno != EINTR)
+            perror("epoll_wait");
+        return 0;
+    }
+
+    int stdin_ready = 0;
+    for (int i = 0; i < n; i++) {
+        switch (evs[i].data.u32) {
+            case EV_STDIN:
+                stdin_ready = 1;
+                break;
+            case EV_MQ:
+                mq_drain();
+                break;
+            case EV_CPUSOCK:
+                cpu_sock_drain();
+                break;
+            case EV_SIGNAL: {
+                struct signalfd_siginfo si;
+                while (read(g_sigfd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+                    if (si.ssi_signo == SIGCHLD)
+                        reap_children();
+                    else
+                        signal_handler((int)si.ssi_signo);
+                }
+                break;
+            }
+        }
+    }
+    if (g_admit_n > 0)
+        admit_dispatch();
+    return stdin_ready;
+}
+
+// Liest eine Zeile (inkl. '\n') von stdin wie fgets, ohne den Thread zu blockieren:
+// bis Eingabe vorliegt, bedient die Event-Loop Signale und die MQ.
+// Rückgabe 0 bei EOF/Fehler.
+static int input_getline(char *dst, size_t size) {
+    size_t out = 0;
+    while (out + 1 < size) {
+        if (g_inpos == g_inlen) {
+            if (g_in_mem)
+                break;
+            if (!event_wait(1, -1))
+                continue;
+            ssize_t n = read(STDIN_FILENO, g_inbuf, sizeof(g_inbuf));
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                break;
+            }
+            if (n == 0)
+                break;
+            g_inlen = (size_t)n;
+            g_inpos = 0;
+        }
+
+        // Bis zum nächsten '\n' (oder Puffer-/Zeilenende) am Stück kopieren
+        size_t avail = g_inlen - g_inpos;
+        size_t room = size - 1 - out;
+        size_t take = avail < room ? avail : room;
+        const char *nl = memchr(g_in + g_inpos, '\n', take);
+        if (nl)
+            take = (size_t)(nl - (g_in + g_inpos)) + 1;
+        memcpy(dst + out, g_in + g_inpos, take);
+        out += take;
+        g_inpos += take;
+        if (nl)
+            break;
+    }
+    dst[out] = '\0';
+    return out > 0;
+}
+
+// Liest eine ganze Zeile beliebiger Länge in einen wachsenden Puffer
+// (*buf/*cap bleiben über Aufrufe erhalten, im Normalfall also kein malloc)
+static int input_readline(char **buf, size_t *cap) {
+    if (*cap < 256) {
+        char *nb = realloc(*buf, 256);
+        if (!nb) return 0;
+        *buf = nb;
+        *cap = 256;
+    }
+    size_t len = 0;
+    for (;;) {
+        if (!input_getline(*buf + len, *cap - len))
+            return len > 0;
+        len += strlen(*buf + len);
+        if ((*buf)[len - 1] == '\n')
+            return 1;
+        if (len + 1 == *cap) {
+            char *nb = realloc(*buf, *cap * 2);
+            if (!nb) {
+                perror("realloc");
+                return 1;
+            }
+            *buf = nb;
+            *cap *= 2;
+        }
+    }
+}
+
+// Eingabe aus dem Speicher lesen (-c 'cmd' bzw. gemapptes Skript)
+static void input_from_memory(const char *buf, size_t len) {
+    g_in = buf;
+    g_inlen = len;
+    g_inpos = 0;
+    g_in_mem = 1;
+}
+
+// Skriptdatei per mmap als Eingabe verwenden
+static int input_from_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        input_from_memory("", 0);
+        return 0;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    input_from_memory(map, (size_t)st.st_size);
+    return 0;
+}
+
+// Event-Loop mit signalfd aufsetzen; die Signale werden dafür blockiert
+static int event_loop_init(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGCONT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("sigprocmask");
+        return -1;
+    }
+
+    g_epfd = epoll_create1(EPOLL_CLOEXEC);
+    g_sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (g_epfd == -1 || g_sigfd == -1) {
+        perror("epoll/signalfd");
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EV_SIGNAL };
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, g_sigfd, &ev);
+
+    // Reguläre Dateien sind nicht pollbar (EPERM) -> direkt lesen
+    ev.events = 0;
+    ev.data.u32 = EV_STDIN;
+    g_stdin_pollable = (epoll_ctl(g_epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0);
+    return 0;
+}
+
+// Wartet, bis der Job nicht mehr läuft (fertig oder gestoppt)
+// (die Event-Loop läuft weiter, CPU-Werte kommen also auch während des Jobs an)
+static void wait_for_job(struct job *j) {
+    reap_children();
+    while (j->state == JOB_RUNNING)
+        event_wait(0, -1);
+}
+
+static void job_signal(struct job *j, int sig) {
+    if (j->pgid > 0) {
+        kill(-j->pgid, sig);
+        return;
+    }
+    for (int k = 0; k < j->nprocs; k++)
+        if (j->procs[k].state != JOB_DONE)
+            kill(j->procs[k].pid, sig);
+}
+
+static void job_continue(struct job *j) {
+    job_signal(j, SIGCONT);
+    for (int k = 0; k < j->nprocs; k++)
+        if (j->procs[k].state == JOB_STOPPED)
+            j->procs[k].state = JOB_RUNNING;
+    job_update_state(j);
+}
+
+static void job_print_stopped(const struct job *j) {
+    printf("\n[%d]+ Gestoppt\t%s\n", j->id, j->cmd);
+}
+
+// Job im Vordergrund laufen lassen (Terminal übergeben, warten, zurückholen)
+static void job_foreground(struct job *j, int cont) {
+    j->background = 0;
+    if (g_interactive && j->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, j->pgid);
+        if (cont && j->has_tmodes)
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &j->tmodes);
+    }
+    if (cont)
+        job_continue(j);
+
+    TRACE(wait_begin, j->cmd, j->pgid);
+    wait_for_job(j);
+
+    if (g_interactive && j->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, g_shell_pgid);
+        if (j->state == JOB_STOPPED) {
+            j->has_tmodes = (tcgetattr(STDIN_FILENO, &j->tmodes) == 0);
+        }
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &g_shell_tmodes);
+    }
+
+    if (j->state == JOB_STOPPED) {
+        j->background = 1;
+        g_last_status = 128 + SIGTSTP;
+        TRACE(wait_end, j->cmd, g_last_status);
+        job_print_stopped(j);
+    } else {
+        // Status der Pipeline = Status der letzten Stufe
+        int st = j->procs[j->nprocs - 1].status;
+        if (WIFSIGNALED(st)) {
+            g_last_status = 128 + WTERMSIG(st);
+            if (WTERMSIG(st) == SIGINT && !g_batch)
+                printf("\n");
+        } else {
+            g_last_status = WEXITSTATUS(st);
+        }
+        TRACE(wait_end, j->cmd, g_last_status);
+        if (j->timed)
+            job_print_times(j);
+        job_free(j);
+    }
+}
+
+static const char *job_state_name(const struct job *j) {
+    switch (j->state) {
+        case JOB_RUNNING: return "Läuft";
+        case JOB_STOPPED: return "Gestoppt";
+        default:          return "Fertig";
+    }
+}
+
+// Fertige Hintergrundjobs melden und austragen (vor jedem Prompt)
+static void jobs_notify(void) {
+    reap_children();
+    for (int i = 0; i < MAX_JOBS; i++) {
+        struct job *j = &g_jobs[i];
+        if (j->state != JOB_DONE || !j->background)
+            continue;
+        if (g_batch) {
+            job_free(j);
+            continue;
+        }
+        int st = j->procs[j->nprocs - 1].status;
+        if (WIFSIGNALED(st))
+            printf("[%d] Beendet (Signal %d)\t%s\n", j->id, WTERMSIG(st), j->cmd);
+        else
+            printf("[%d] Fertig (%d)\t%s\n", j->id, WEXITSTATUS(st), j->cmd);
+        if (j->timed) {
+            fflush(stdout);
+            job_print_times(j);
+        }
+        job_free(j);
+    }
+}
+
+// Shell als Job-Control-Shell einrichten (nur interaktiv)
+static void job_control_init(void) {
+    g_interactive = !g_batch && isatty(STDIN_FILENO);
+    if (!g_interactive)
+        return;
+
+    // Warten, bis die Shell im Vordergrund ist
+    while (tcgetpgrp(STDIN_FILENO) != (g_shell_pgid = getpgrp()))
+        kill(-g_shell_pgid, SIGTTIN);
+
+    signal(SIGTTOU, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+
+    g_shell_pgid = getpid();
+    if (getpgrp() != g_shell_pgid && setpgid(g_shell_pgid, g_shell_pgid) < 0) {
+        perror("setpgid");
+        g_interactive = 0;
+        return;
+    }
+    tcsetpgrp(STDIN_FILENO, g_shell_pgid);
+    tcgetattr(STDIN_FILENO, &g_shell_tmodes);
+}
+
+// Umlenkungen
+// Deskriptor mit CLOEXEC oberhalb von MIN_REDIR_FD ablegen, damit er nicht
+// mit einem Ziel-Deskriptor kollidiert
+static int fd_move_high(int fd) {
+    if (fd < 0 || fd >= MIN_REDIR_FD)
+        return fd;
+    int hi = fcntl(fd, F_DUPFD_CLOEXEC, MIN_REDIR_FD);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return hi;
+}
+
+// Here-String: Text + '\n' als lesbarer Deskriptor. Passt er in den Pipe-Puffer,
+// genügt eine Pipe; sonst ein memfd (kein Deadlock beim Schreiben). Der Puffer
+// kann kleiner als 64 KiB sein (pipe-user-pages-soft überschritten), daher
+// schreibt die Shell nicht-blockierend und nimmt bei EAGAIN/Teilschreiben das memfd.
+static int herestring_fd(const char *text) {
+    size_t len = strlen(text);
+    int p[2];
+    if (len + 1 <= 65536 && pipe2(p, O_CLOEXEC) == 0) {
+        struct iovec iov[2] = { { (void *)text, len }, { "\n", 1 } };
+        ssize_t w = fcntl(p[1], F_SETFL, O_NONBLOCK) == 0 ? writev(p[1], iov, 2) : -1;
+        close(p[1]);
+        if (w == (ssize_t)(len + 1))
+            return fd_move_high(p[0]);
+        close(p[0]);
+    }
+    int fd = memfd_create("herestring", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (write(fd, text, len) != (ssize_t)len || write(fd, "\n", 1) != 1 ||
+        lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd_move_high(fd);
+}
+
+static void redirs_close(struct fd_map *maps, int nmaps) {
+    for (int i = 0; i < nmaps; i++)
+        if (maps[i].owned)
+            close(maps[i].from);
+}
+
+// Öffnet die Umlenkungsziele eines Kommandos in der Shell. So kommen Fehler
+// mit Dateinamen zurück, und beide Spawn-Engines brauchen nur dup2.
+// Rückgabe -1 bei Fehler (Meldung ausgegeben, nichts bleibt offen).
+static int redirs_open(const struct command *cmd, struct fd_map **out, int *nout) {
+    int n = 0;
+    for (const struct redir *r = cmd->redirs; r; r = r->next)
+        n++;
+    *out = NULL;
+    *nout = 0;
+    if (n == 0)
+        return 0;
+
+    struct fd_map *maps = arena_alloc(&g_line_arena, (size_t)n * sizeof(*maps));
+    int k = 0;
+    for (const struct redir *r = cmd->redirs; r; r = r->next, k++) {
+        int from;
+        maps[k].to = r->fd;
+        maps[k].owned = 1;
+        switch (r->type) {
+            case TOK_REDIR_IN:
+                from = open(r->target, O_RDONLY | O_CLOEXEC);
+                break;
+            case TOK_REDIR_OUT:
+                from = open(r->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+                break;
+            case TOK_REDIR_APPEND:
+                from = open(r->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+                break;
+            case TOK_HERESTR:
+                from = herestring_fd(r->target);
+                break;
+            default: {   // TOK_REDIR_DUP: n>&m
+                char *end;
+                long m = strtol(r->target, &end, 10);
+                if (*end != '\0' || m < 0 || m > INT_MAX) {
+                    fprintf(stderr, "%s: ungültiger Deskriptor\n", r->target);
+                    redirs_close(maps, k);
+                    return -1;
+                }
+                from = (int)m;
+                maps[k].owned = 0;
+                break;
+            }
+        }
+        if (maps[k].owned)
+            from = fd_move_high(from);
+        if (from < 0) {
+            perror(r->target);
+            redirs_close(maps, k);
+            return -1;
+        }
+        maps[k].from = from;
+    }
+    *out = maps;
+    *nout = n;
+    return 0;
+}
+
+// Für Built-Ins: Umlenkungen in der Shell selbst anwenden; saved nimmt die
+// Originale auf (-1 = war geschlossen)
+static void redirs_apply_shell(const struct fd_map *maps, int nmaps, int *saved) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < nmaps; i++) {
+        saved[i] = fcntl(maps[i].to, F_DUPFD_CLOEXEC, MIN_REDIR_FD);
+        if (maps[i].from != maps[i].to)
+            dup2(maps[i].from, maps[i].to);
+    }
+}
+
+static void redirs_restore_shell(const struct fd_map *maps, int nmaps, const int *saved) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = nmaps - 1; i >= 0; i--) {
+        if (saved[i] >= 0) {
+            dup2(saved[i], maps[i].to);
+            close(saved[i]);
+        } else {
+            close(maps[i].to);
+        }
+    }
+}
+
+// Kopiert in -> out möglichst ohne Umweg über den User-Space:
+// copy_file_range (Datei -> Datei), sendfile (aus Datei), splice (Pipe beteiligt),
+// sonst read/write. Rückgabe 0 oder -1 (errno gesetzt).
+static int copy_fd(int in, int out) {
+    enum { M_CFR, M_SENDFILE, M_SPLICE, M_RW } mode = M_RW;
+    const size_t chunk = 1 << 20;
+    struct stat si, so;
+    if (fstat(in, &si) == 0 && fstat(out, &so) == 0) {
+        if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode))  mode = M_CFR;
+        else if (S_ISREG(si.st_mode))                    mode = M_SENDFILE;
+        else if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode)) mode = M_SPLICE;
+    }
+
+    for (;;) {
+        ssize_t n;
+        switch (mode) {
+            case M_CFR:      n = copy_file_range(in, NULL, out, NULL, chunk, 0); break;
+            case M_SENDFILE: n = sendfile(out, in, NULL, chunk); break;
+            case M_SPLICE:   n = splice(in, NULL, out, NULL, chunk, SPLICE_F_MOVE); break;
+            default: {
+                char buf[65536];
+                n = read(in, buf, sizeof(buf));
+                for (ssize_t off = 0; n > 0 && off < n; ) {
+                    ssize_t w = write(out, buf + off, (size_t)(n - off));
+                    if (w < 0) {
+                        if (errno == EINTR) continue;
+                        return -1;
+                    }
+                    off += w;
+                }
+                break;
+            }
+        }
+        if (n == 0)
+            return 0;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            // Kombination vom Kernel nicht unterstützt -> nächstschwächere Methode
+            if (mode != M_RW && (errno == EINVAL || errno == ENOSYS || errno == EBADF ||
+                                 errno == EXDEV || errno == EOPNOTSUPP)) {
+                mode = (mode == M_CFR) ? M_SENDFILE : M_RW;
+                continue;
+            }
+            return -1;
+        }
+    }
+}
+
+// cat als Built-In nur ohne Optionen und wenn nicht interaktiv vom
+// Terminal gelesen wird (sonst wäre Strg+C wirkungslos)
+static int cat_builtin_ok(const struct command *cmd) {
+    int needs_stdin = (cmd->argc == 1);
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *a = cmd->argv[i];
+        if (a[0] == '-' && a[1] != '\0')
+            return 0;
+        if (strcmp(a, "-") == 0)
+            needs_stdin = 1;
+    }
+    if (!needs_stdin)
+        return 1;
+    for (const struct redir *r = cmd->redirs; r; r = r->next)
+        if (r->fd == STDIN_FILENO)
+            return 1;
+    return !isatty(STDIN_FILENO);
+}
+
+// Im Shell-Prozess nur mit endlicher Eingabe aus regulären Dateien: copy_fd kehrt
+// nicht zur Event-Loop zurück, Strg+C und kill kämen bei FIFO, /dev/zero oder einer
+// Pipe nicht durch. Sonst läuft cat als geforkte Stufe (mit &, Präfixen, in Pipelines).
+static int cat_in_shell(const struct command *cmd) {
+    struct stat st;
+    int needs_stdin = (cmd->argc == 1);
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *a = cmd->argv[i];
+        if (strcmp(a, "-") == 0)
+            needs_stdin = 1;
+        else if (stat(a, &st) == 0 && !S_ISREG(st.st_mode))
+            return 0;   // fehlende Dateien meldet builtin_cat selbst
+    }
+    if (!needs_stdin)
+        return 1;
+    const struct redir *in = NULL;
+    for (const struct redir *r = cmd->redirs; r; r = r->next)
+        if (r->fd == STDIN_FILENO)
+            in = r;     // die letzte Umlenkung gilt
+    if (!in)
+        return fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode);
+    if (in->type == TOK_HERESTR)
+        return 1;
+    return in->type == TOK_REDIR_IN && stat(in->target, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Built-In cat: Daten bewegt der Kernel (splice/sendfile/copy_file_range)
+static int builtin_cat(char *args[]) {
+    int status = 0;
+    fflush(stdout);
+    for (int i = 1; args[i] || i == 1; i++) {
+        const char *name = args[i] ? args[i] : "-";
+        int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+        } else {
+            if (copy_fd(fd, STDOUT_FILENO) != 0) {
+                fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+                status = 1;
+            }
+            if (fd != STDIN_FILENO)
+                close(fd);
+        }
+        if (!args[i])
+            break;
+    }
+    return status;
+}
+
+// Admission Control: "&"-Jobs werden zurückgehalten, solange die CPU-Last über
+// der Schwelle liegt oder schon max Hintergrundjobs laufen, und in Reihenfolge
+// gestartet, sobald es wieder passt (geprüft in event_wait und vor dem Prompt).
+#define ADMIT_QUEUE_MAX 256
+struct admit_entry {
+    char *text;                    // Originalzeile, wird beim Start neu geparst
+    unsigned long long enq_ns;
+};
+static struct admit_entry g_admit_q[ADMIT_QUEUE_MAX];
+static int g_admit_head = 0;       // g_admit_n (oben) = Anzahl wartender Einträge
+static double g_admit_load = 0;    // Schwelle in %, 0 = aus
+static int g_admit_max = 0;        // max. laufende Hintergrundjobs, 0 = aus
+static int g_admit_busy = 0;       // gerade beim Starten (kein Wiedereintritt)
+static unsigned long long g_admit_last_ts = 0;   // Sample, nach dem zuletzt gestartet wurde
+static unsigned long g_admit_started = 0;
+static unsigned long long g_admit_wait_total = 0, g_admit_wait_max = 0;
+
+static void execute_list(struct pipeline *pl);
+
+static int admit_enabled(void) {
+    return g_admit_load > 0 || g_admit_max > 0;
+}
+
+static int bg_running(void) {
+    int n = 0;
+    for (int i = 0; i < MAX_JOBS; i++)
+        if (g_jobs[i].state == JOB_RUNNING && g_jobs[i].background)
+            n++;
+    return n;
+}
+
+// Darf jetzt ein Hintergrundjob starten?
+static int admit_ok(void) {
+    if (g_admit_max > 0 && bg_running() >= g_admit_max)
+        return 0;
+    if (g_admit_load > 0) {
+        struct cpuload_sample smp;
+        // ohne Lastwert (cpuloadd fehlt) nur nach Jobanzahl entscheiden
+        if (cpu_sample_now(&smp) < 0)
+            return 1;
+        if (smp.load >= g_admit_load)
+            return 0;
+        // pro Sample nur einen Job: die Last des gerade gestarteten sieht erst das nächste
+        if (smp.timestamp_ns && smp.timestamp_ns == g_admit_last_ts)
+            return 0;
+        g_admit_last_ts = smp.timestamp_ns;
+    }
+    return 1;
+}
+
+// 1 = zurückgehalten, 0 = sofort starten
+static int admit_enqueue(const struct pipeline *pl) {
+    if (!admit_enabled() || g_admit_busy)
+        return 0;
+    reap_children();
+    if (g_admit_n == 0 && admit_ok())
+        return 0;
+    if (g_admit_n == ADMIT_QUEUE_MAX) {
+        fprintf(stderr, "[Warteschlange] voll (%d Jobs), starte sofort\n", ADMIT_QUEUE_MAX);
+        return 0;
+    }
+    char *text = strdup(pl->text);
+    if (!text) {
+        perror("strdup");
+        return 0;
+    }
+    struct admit_entry *e = &g_admit_q[(g_admit_head + g_admit_n++) % ADMIT_QUEUE_MAX];
+    e->text = text;
+    e->enq_ns = now_ns();
+    if (!g_batch)
+        printf("[Warteschlange] Position %d: %s\n", g_admit_n, text);
+    return 1;
+}
+
+static void admit_dispatch(void) {
+    if (g_admit_busy)
+        return;
+    g_admit_busy = 1;
+    int saved_status = g_last_status;
+    int started = 0;
+    while (g_admit_n > 0 && (!admit_enabled() || admit_ok())) {
+        struct admit_entry e = g_admit_q[g_admit_head];
+        g_admit_head = (g_admit_head + 1) % ADMIT_QUEUE_MAX;
+        g_admit_n--;
+
+        unsigned long long waited = now_ns() - e.enq_ns;
+        g_admit_started++;
+        g_admit_wait_total += waited;
+        if (waited > g_admit_wait_max) g_admit_wait_max = waited;
+        if (!g_batch)
+            printf("%s[Warteschlange] nach %.1f s gestartet: %s\n",
+                   g_at_prompt ? "\n" : "", (double)waited / 1e9, e.text);
+
+        // Läuft ggf. mitten in einer Zeile: die Arena wird nur ergänzt, nicht zurückgesetzt
+        char *line = arena_strdup(&g_line_arena, e.text);
+        char *text = arena_strdup(&g_line_arena, e.text);
+        free(e.text);
+        struct pipeline *pl = parse_command(line, text, &g_line_arena);
+        if (pl)
+            execute_list(pl);
+        started++;
+    }
+    g_last_status = saved_status;
+    g_admit_busy = 0;
+    if (started && g_at_prompt)
+        prompt_redraw();
+}
+
+// Alle zurückgehaltenen Jobs abarbeiten (wait, Ende eines Skripts)
+static void admit_drain(void) {
+    while (g_admit_n > 0) {
+        admit_dispatch();
+        if (g_admit_n > 0)
+            event_wait(0, ADMIT_POLL_MS);
+    }
+}
+
+static void admit_print(void) {
+    printf("Admission: ");
+    if (!admit_enabled())
+        printf("aus");
+    if (g_admit_load > 0)
+        printf("Last < %.0f%%%s", g_admit_load, g_admit_max > 0 ? ", " : "");
+    if (g_admit_max > 0)
+        printf("max %d laufend", g_admit_max);
+    printf("\n  Warteschlange %d, laufend %d, gestartet %lu", g_admit_n, bg_running(), g_admit_started);
+    if (g_admit_started)
+        printf(", Wartezeit avg %.1f s max %.1f s",
+               (double)g_admit_wait_total / 1e9 / (double)g_admit_started,
+               (double)g_admit_wait_max / 1e9);
+    printf("\n");
+    unsigned long long now = now_ns();
+    for (int k = 0; k < g_admit_n; k++) {
+        const struct admit_entry *e = &g_admit_q[(g_admit_head + k) % ADMIT_QUEUE_MAX];
+        printf("  [Q%d] wartet %.1f s  %s\n", k + 1, (double)(now - e->enq_ns) / 1e9, e->text);
+    }
+}
+
+// admit [load <pct>|max <n>|off] -> Admission Control für "&"-Jobs
+static int builtin_admit(char *args[]) {
+    if (args[1] == NULL) {
+        admit_print();
+        return 0;
+    }
+    if (strcmp(args[1], "off") == 0 && args[2] == NULL) {
+        g_admit_load = 0;
+        g_admit_max = 0;
+        admit_dispatch();          // Wartende sofort starten
+        return 0;
+    }
+    for (int i = 1; args[i]; i += 2) {
+        const char *val = args[i + 1];
+        char *end = NULL;
+        if (!val) goto usage;
+        int off = strcmp(val, "off") == 0;
+        if (strcmp(args[i], "load") == 0) {
+            double v = off ? 0 : strtod(val, &end);
+            if ((!off && (*end != '\0' || v <= 0 || v > 100))) goto usage;
+            g_admit_load = v;
+        } else if (strcmp(args[i], "max") == 0) {
+            long v = off ? 0 : strtol(val, &end, 10);
+            if ((!off && (*end != '\0' || v <= 0 || v > MAX_JOBS))) goto usage;
+            g_admit_max = (int)v;
+        } else {
+            goto usage;
+        }
+    }
+    admit_dispatch();
+    return 0;
+usage:
+    fprintf(stderr, "admit: [load <prozent>|off] [max <n>|off] | off\n");
+    return 2;
+}
+
+// CPU-Historie aus dem cpuloadd-Segment; statisch, da bis zu CPULOAD_HIST_LEN Einträge
+static struct cpuload_hist_entry g_hist_buf[CPULOAD_HIST_LEN];
+static float g_hist_sort[CPULOAD_HIST_LEN];
+
+static int float_cmp(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+// Statistik über alle Einträge, deren Intervall [ts - iv, ts] den Zeitraum [from, to] berührt
+struct hist_stats {
+    size_t n;
+    float min, max, avg, p95, core_max;
+};
+
+static void hist_stats(const struct cpuload_hist_entry *e, size_t n, unsigned long long iv_ns,
+                       unsigned long long from, unsigned long long to, struct hist_stats *st) {
+    double sum = 0;
+    memset(st, 0, sizeof(*st));
+    st->core_max = -1;
+    for (size_t i = 0; i < n; i++) {
+        if (e[i].timestamp_ns < from || e[i].timestamp_ns - iv_ns > to)
+            continue;
+        float v = e[i].load;
+        if (st->n == 0 || v < st->min) st->min = v;
+        if (st->n == 0 || v > st->max) st->max = v;
+        if (e[i].core_max > st->core_max) st->core_max = e[i].core_max;
+        g_hist_sort[st->n++] = v;
+        sum += v;
+    }
+    if (st->n == 0)
+        return;
+    st->avg = (float)(sum / (double)st->n);
+    qsort(g_hist_sort, st->n, sizeof(float), float_cmp);
+    size_t k = (st->n * 95 + 99) / 100;     // nearest rank
+    st->p95 = g_hist_sort[k ? k - 1 : 0];
+}
+
+static void hist_print_job(int id, const char *cmd, const char *state,
+                           unsigned long long start, unsigned long long end,
+                           const struct cpuload_hist_entry *e, size_t n, unsigned long long iv_ns) {
+    struct hist_stats st;
+    hist_stats(e, n, iv_ns, start, end, &st);
+    printf("  [%d] %-24.24s %-8s %8.1f s  ", id, cmd, state, (double)(end - start) / 1e9);
+    if (st.n)
+        printf("avg %5.1f%%  max %5.1f%%  (%zu Samples)\n", st.avg, st.max, st.n);
+    else
+        printf("keine Samples\n");
+}
+
+// cpuhist [sekunden] -> min/avg/max/p95 der letzten Sekunden (Default 60)
+// und die Last während laufender und der letzten abgeschlossenen Jobs
+static int builtin_cpuhist(char *args[]) {
+    long window = 60;
+    if (args[1]) {
+        char *end;
+        window = strtol(args[1], &end, 10);
+        if (*end != '\0' || window <= 0) {
+            fprintf(stderr, "cpuhist: [sekunden]\n");
+            return 2;
+        }
+    }
+    cpu_shm_ensure(time(NULL));
+    if (!g_cpu_shm) {
+        fprintf(stderr, "cpuhist: keine Historie (cpuloadd läuft nicht?)\n");
+        return 1;
+    }
+    size_t n = cpuload_hist_copy(g_cpu_shm, g_hist_buf, CPULOAD_HIST_LEN);
+    struct cpuload_sample cur;
+    unsigned long long iv_ns = 10000000000ull;
+    if (cpuload_read(g_cpu_shm, &cur) == 0 && cur.interval_ms)
+        iv_ns = (unsigned long long)cur.interval_ms * 1000000ull;
+
+    unsigned long long now = realtime_ns();
+    unsigned long long from = now - (unsigned long long)window * 1000000000ull;
+    struct hist_stats st;
+    hist_stats(g_hist_buf, n, 0, from, now, &st);
+    printf("CPU-Historie: letzte %ld s, %zu Samples (Intervall %llu ms, %zu gespeichert)\n",
+           window, st.n, iv_ns / 1000000ull, n);
+    if (st.n) {
+        printf("  Last  min %.1f%%  avg %.1f%%  max %.1f%%  p95 %.1f%%\n",
+               st.min, st.avg, st.max, st.p95);
+        if (st.core_max >= 0)
+            printf("  Kern  max %.1f%%\n", st.core_max);
+    }
+
+    int header = 0;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        const struct job *j = &g_jobs[i];
+        if (j->state == JOB_FREE) continue;
+        if (!header++) printf("Jobs:\n");
+        unsigned long long end = j->end_ns ? mono_to_rt(j->end_ns) : now;
+        hist_print_job(j->id, j->cmd, job_state_name(j),
+                       mono_to_rt(j->start_ns), end, g_hist_buf, n, iv_ns);
+    }
+    unsigned cnt = g_job_hist_n < JOB_HIST_LEN ? g_job_hist_n : JOB_HIST_LEN;
+    for (unsigned k = 0; k < cnt; k++) {
+        const struct job_hist *h = &g_job_hist[(g_job_hist_n - cnt + k) % JOB_HIST_LEN];
+        if (!header++) printf("Jobs:\n");
+        hist_print_job(h->id, h->cmd, "Fertig", h->start_rt, h->end_rt, g_hist_buf, n, iv_ns);
+    }
+    return 0;
+}
+
+// parallel: dasselbe Kommando für viele Eingabezeilen mit höchstens N
+// gleichzeitigen Kindern. Jedes Kind schreibt stdout/stderr in eigene memfds,
+// die in Eingabereihenfolge ausgegeben werden, sobald alle Vorgänger fertig sind.
+struct par_task {
+    pid_t pid;                 // 0 = noch nicht gestartet, -1 = Start fehlgeschlagen
+    int out_fd, err_fd;
+    int status;
+    int done;
+};
+static struct par_task *g_par_tasks = NULL;   // laufender parallel-Aufruf
+static size_t g_par_first = 0, g_par_end = 0; // Fenster mit gestarteten, nicht ausgegebenen Tasks
+static int g_par_running = 0;
+
+// Von reap_children für Kinder ohne Jobeintrag; 1 = gehörte zu parallel
+static int par_reaped(pid_t pid, int status) {
+    for (size_t i = g_par_first; g_par_tasks && i < g_par_end; i++) {
+        struct par_task *t = &g_par_tasks[i];
+        if (t->pid != pid || t->done)
+            continue;
+        if (WIFSTOPPED(status)) {
+            kill(pid, SIGCONT);    // kein eigener Job: gestoppte Kinder weiterlaufen lassen
+        } else if (!WIFCONTINUED(status)) {
+            t->status = status;
+            t->done = 1;
+            g_par_running--;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Eingabe ganz lesen (stdin oder Datei, inkl. Shell-Umlenkung), NUL-terminiert.
+// Gewartet wird per poll zusammen mit der signalfd, damit Strg+C auch beim Lesen
+// von einem Terminal oder einer FIFO abbricht (NULL mit errno = EINTR).
+static char *par_read_input(int fd, size_t *len) {
+    unsigned sigint0 = g_sigint_count;
+    size_t cap = 65536, n = 0;
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+    for (;;) {
+        if (n + 1 >= cap) {        // Platz für den abschließenden Terminator
+            char *nb = realloc(buf, cap * 2);
+            if (!nb) { free(buf); return NULL; }
+            buf = nb;
+            cap *= 2;
+        }
+        struct pollfd pfd[2] = { { fd, POLLIN, 0 }, { g_sigfd, POLLIN, 0 } };
+        if (poll(pfd, g_sigfd >= 0 ? 2 : 1, -1) < 0 && errno != EINTR) {
+            free(buf);
+            return NULL;
+        }
+        if (pfd[1].revents)
+            event_wait(0, 0);    // Signale wie in der Event-Loop behandeln
+        if (g_sigint_count != sigint0) {
+            free(buf);
+            errno = EINTR;
+            return NULL;
+        }
+        if (!pfd[0].revents)
+            continue;
+        ssize_t r = read(fd, buf + n, cap - n);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return NULL;
+        }
+        if (r == 0) break;
+        n += (size_t)r;
+    }
+    buf[n] = '\0';
+    *len = n;
+    return buf;
+}
+
+// Argumentvektor für eine Eingabezeile: "{}" (auch innerhalb eines Worts)
+// wird ersetzt; kommt es nicht vor, wird die Zeile angehängt
+static char **par_build_argv(char **tmpl, int ntmpl, const char *arg, struct arena *a) {
+    char **argv = arena_alloc(a, sizeof(char *) * (size_t)(ntmpl + 2));
+    int used = 0;
+    size_t alen = strlen(arg);
+    for (int i = 0; i < ntmpl; i++) {
+        const char *w = tmpl[i];
+        if (!strstr(w, "{}")) {
+            argv[i] = (char *)w;
+            continue;
+        }
+        used = 1;
+        size_t cnt = 0;
+        for (const char *p = w; (p = strstr(p, "{}")); p += 2) cnt++;
+        char *out = arena_alloc(a, strlen(w) + cnt * alen + 1), *o = out;
+        for (const char *p = w; *p; ) {
+            if (p[0] == '{' && p[1] == '}') {
+                memcpy(o, arg, alen);
+                o += alen;
+                p += 2;
+            } else {
+                *o++ = *p++;
+            }
+        }
+        *o = '\0';
+        argv[i] = out;
+    }
+    argv[ntmpl] = used ? NULL : (char *)arg;
+    argv[ntmpl + 1] = NULL;
+    return argv;
+}
+
+static void par_flush_output(struct par_task *t) {
+    fflush(stdout);
+    fflush(stderr);
+    if (t->out_fd >= 0) {
+        lseek(t->out_fd, 0, SEEK_SET);
+        copy_fd(t->out_fd, STDOUT_FILENO);
+        close(t->out_fd);
+    }
+    if (t->err_fd >= 0) {
+        lseek(t->err_fd, 0, SEEK_SET);
+        copy_fd(t->err_fd, STDERR_FILENO);
+        close(t->err_fd);
+    }
+    t->out_fd = t->err_fd = -1;
+}
+
+// parallel [-j N] [-a datei] [-l last] kommando [arg ...]
+static int builtin_parallel(char *args[]) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *file = NULL;
+    double max_load = 0;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-'; i += 2) {
+        char *end;
+        if (!args[i + 1])
+            goto usage;          // Option ohne Wert
+        if (strcmp(args[i], "-j") == 0) {
+            jobs = strtol(args[i + 1], &end, 10);
+            if (*end != '\0' || jobs <= 0) goto usage;
+        } else if (strcmp(args[i], "-a") == 0) {
+            file = args[i + 1];
+        } else if (strcmp(args[i], "-l") == 0) {
+            max_load = strtod(args[i + 1], &end);
+            if (*end != '\0' || max_load <= 0) goto usage;
+        } else {
+            goto usage;
+        }
+    }
+    if (!args[i])
+        goto usage;
+    if (jobs <= 0) jobs = 1;
+    if (g_par_tasks) {
+        fprintf(stderr, "parallel: läuft bereits\n");
+        return 1;
+    }
+    char **tmpl = &args[i];
+    int ntmpl = 0;
+    while (tmpl[ntmpl]) ntmpl++;
+
+    int in = STDIN_FILENO;
+    if (file && (in = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "parallel: %s: %s\n", file, strerror(errno));
+        return 1;
+    }
+    size_t len;
+    char *input = par_read_input(in, &len);
+    int err = errno;
+    if (in != STDIN_FILENO) close(in);
+    if (!input) {
+        if (err == EINTR)
+            return 128 + SIGINT;   // Strg+C während des Lesens
+        fprintf(stderr, "parallel: %s\n", strerror(err));
+        return 1;
+    }
+
+    // Zeilen in place terminieren
+    size_t n = 0;
+    for (size_t k = 0; k < len; k++)
+        if (input[k] == '\n') n++;
+    if (len && input[len - 1] != '\n') n++;
+    char **lines = malloc(sizeof(char *) * (n ? n : 1));
+    struct par_task *tasks = calloc(n ? n : 1, sizeof(*tasks));
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (!lines || !tasks || devnull < 0) {
+        perror("parallel");
+        free(lines); free(tasks); free(input);
+        if (devnull >= 0) close(devnull);
+        return 1;
+    }
+    size_t nl = 0;
+    for (char *p = input, *end = input + len; p < end; ) {
+        char *e = memchr(p, '\n', (size_t)(end - p));
+        if (e) *e = '\0';
+        lines[nl++] = p;
+        p = e ? e + 1 : end;
+    }
+
+    // Vorauslauf begrenzen: fertige, noch nicht ausgegebene Tasks halten 2 fds
+    size_t window = (size_t)jobs * 4 < 16 ? 16 : (size_t)jobs * 4;
+    g_par_tasks = tasks;
+    g_par_first = g_par_end = 0;
+    g_par_running = 0;
+    unsigned sigint0 = g_sigint_count;
+    int failed = 0;
+
+    while (g_par_first < nl) {
+        int throttled = 0;
+        while (g_sigint_count == sigint0 && g_par_end < nl &&
+               g_par_running < jobs && g_par_end - g_par_first < window) {
+            struct cpuload_sample smp;
+            if (max_load > 0 && g_par_running > 0 &&
+                cpu_sample_now(&smp) >= 0 && smp.load >= max_load) {
+                throttled = 1;
+                break;
+            }
+            struct par_task *t = &tasks[g_par_end];
+            t->out_fd = memfd_create("parallel-out", MFD_CLOEXEC);
+            t->err_fd = memfd_create("parallel-err", MFD_CLOEXEC);
+            char **argv = par_build_argv(tmpl, ntmpl, lines[g_par_end], &g_line_arena);
+            struct fd_map err_map = { .from = t->err_fd, .to = STDERR_FILENO, .owned = 0 };
+            const struct builtin *b = builtin_find(argv[0]);
+            struct spawn_opts o = {
+                .in_fd = devnull, .out_fd = t->out_fd,
+                .maps = &err_map, .nmaps = t->err_fd >= 0,
+                .pgid = -1, .foreground = 0,
+                .builtin = b && b->stage ? b->fn : NULL,
+            };
+            g_par_end++;
+            pid_t pid = (t->out_fd >= 0) ? spawn_cmd(argv, &o) : -1;
+            if (pid < 0) {
+                t->pid = -1;
+                t->status = 127 << 8;
+                t->done = 1;
+            } else {
+                t->pid = pid;
+                g_par_running++;
+            }
+        }
+
+        // in Eingabereihenfolge ausgeben
+        while (g_par_first < g_par_end && tasks[g_par_first].done) {
+            struct par_task *t = &tasks[g_par_first++];
+            par_flush_output(t);
+            if (!WIFEXITED(t->status) || WEXITSTATUS(t->status) != 0)
+                failed++;
+        }
+        if (g_par_first == nl)
+            break;
+        if (g_sigint_count != sigint0 && g_par_running == 0) {
+            // abgebrochen: Rest gilt als fehlgeschlagen
+            for (; g_par_first < g_par_end; g_par_first++)
+                par_flush_output(&tasks[g_par_first]);
+            failed += (int)(nl - g_par_first);
+            break;
+        }
+        event_wait(0, throttled ? ADMIT_POLL_MS : -1);
+    }
+
+    g_par_tasks = NULL;
+    g_par_first = g_par_end = 0;
+    close(devnull);
+    free(lines);
+    free(tasks);
+    free(input);
+    // wie GNU parallel: Anzahl fehlgeschlagener Jobs, höchstens 101
+    return failed > 101 ? 101 : failed;
+
+usage:
+    fprintf(stderr, "parallel: [-j n] [-a datei] [-l last] kommando [arg ...]  ({} = Eingabezeile)\n");
+    return 2;
+}
+
+// echo, printf, test/[, true, false: häufige Skriptzeilen ohne fork/exec.
+// Sie hängen von keinem Shell-Zustand ab und laufen als Pipeline-Stufe
+// (oder mit & bzw. Präfixen) in einem geforkten Kind ohne exec.
+
+// Eine Backslash-Folge ab p (hinter dem '\') auswerten; Zeichen nach *out,
+// -1 für \c (Ausgabe beenden). octal0: Oktal nur als \0nnn (echo -e, %b),
+// sonst \nnn (printf-Format). Unbekannte Folgen bleiben mit '\' stehen.
+static const char *escape_char(const char *p, int octal0, int *out) {
+    int c = (unsigned char)*p++;
+    switch (c) {
+    case 'a':  *out = '\a'; break;
+    case 'b':  *out = '\b'; break;
+    case 'e':
+    case 'E':  *out = 033;  break;
+    case 'f':  *out = '\f'; break;
+    case 'n':  *out = '\n'; break;
+    case 'r':  *out = '\r'; break;
+    case 't':  *out = '\t'; break;
+    case 'v':  *out = '\v'; break;
+    case '\\': *out = '\\'; break;
+    case 'c':  *out = -1;   break;
+    case 'x': {
+        int v = 0, k = 0;
+        for (; k < 2 && isxdigit((unsigned char)*p); k++, p++)
+            v = v * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (*p | 0x20) - 'a' + 10);
+        if (k == 0) {
+            *out = '\\';
+            return p - 1;
+        }
+        *out = v;
+        break;
+    }
+    default:
+        if (c >= '0' && c <= '7' && (!octal0 || c == '0')) {
+            int v = octal0 ? 0 : c - '0';
+            for (int k = 0; k < (octal0 ? 3 : 2) && *p >= '0' && *p <= '7'; k++, p++)
+                v = v * 8 + (*p - '0');
+            *out = v & 0xff;
+            break;
+        }
+        *out = '\\';
+        return p - 1;
+    }
+    return p;
+}
+
+// s mit ausgewerteten Backslash-Folgen nach buf (passt immer: wird nie länger).
+// Rückgabe: Länge, -1 wenn \c vorkam (buf enthält den Teil davor).
+static int unescape(const char *s, char *buf, int octal0, size_t *len) {
+    size_t n = 0;
+    int r = 0;
+    while (*s) {
+        if (*s != '\\') {
+            buf[n++] = *s++;
+            continue;
+        }
+        int ch;
+        s = escape_char(s + 1, octal0, &ch);
+        if (ch < 0) {
+            r = -1;
+            break;
+        }
+        buf[n++] = (char)ch;
+    }
+    buf[n] = '\0';
+    *len = n;
+    return r;
+}
+
+// Schreibfehler (volle Platte, geschlossene Pipe) als Status 1 melden. Geleert wird
+// hier, solange die Umlenkung noch gilt; sonst käme der Fehler erst später ans Licht.
+static int builtin_out_status(const char *name) {
+    if (fflush(stdout) == 0 && !ferror(stdout))
+        return 0;
+    fprintf(stderr, "%s: Schreibfehler\n", name);
+    clearerr(stdout);
+    return 1;
+}
+
+// echo [-neE] [arg ...]
+static int builtin_echo(char *args[]) {
+    int newline = 1, esc = 0, i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        const char *f = args[i] + 1;
+        if (f[strspn(f, "neE")] != '\0')
+            break;   // kein Optionsblock -> normales Argument
+        for (; *f; f++) {
+            if (*f == 'n')      newline = 0;
+            else if (*f == 'e') esc = 1;
+            else                esc = 0;
+        }
+    }
+    for (int first = i; args[i]; i++) {
+        if (i > first)
+            putchar(' ');
+        if (!esc) {
+            fputs(args[i], stdout);
+            continue;
+        }
+        char *buf = arena_alloc(&g_line_arena, strlen(args[i]) + 1);
+        size_t len;
+        int r = unescape(args[i], buf, 1, &len);
+        fwrite(buf, 1, len, stdout);
+        if (r < 0)
+            return builtin_out_status("echo");
+    }
+    if (newline)
+        putchar('\n');
+    return builtin_out_status("echo");
+}
+
+// Zahlenargument für printf; 'c bzw. "c ergibt den Zeichenwert
+static long long printf_int(const char *s, int *status) {
+    if (!s)
+        return 0;
+    if (*s == '\'' || *s == '"')
+        return (unsigned char)s[1];
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 0);
+    if (end == s || *end != '\0' || errno != 0) {
+        fprintf(stderr, "printf: %s: ungültige Zahl\n", s);
+        *status = 1;
+    }
+    return v;
+}
+
+static double printf_float(const char *s, int *status) {
+    if (!s)
+        return 0;
+    if (*s == '\'' || *s == '"')
+        return (unsigned char)s[1];
+    char *end;
+    errno = 0;
+    double v = strtod(s, &end);
+    if (end == s || *end != '\0' || errno != 0) {
+        fprintf(stderr, "printf: %s: ungültige Zahl\n", s);
+        *status = 1;
+    }
+    return v;
+}
+
+// printf format [arg ...]
+// %[-+ #0][breite][.genauigkeit] mit d i o u x X c s b e E f F g G a A und %%;
+// Breite/Genauigkeit auch als *. Das Format wird wiederholt, solange Argumente übrig sind.
+static int builtin_printf(char *args[]) {
+    if (!args[1]) {
+        fprintf(stderr, "printf: format [arg ...]\n");
+        return 2;
+    }
+    const char *fmt = args[1];
+    char **av = args + 2;
+    int status = 0;
+    char **pass;
+    do {
+        pass = av;
+        for (const char *p = fmt; *p; p++) {
+            if (*p == '\\') {
+                int ch;
+                p = escape_char(p + 1, 0, &ch) - 1;
+                if (ch < 0)
+                    goto out;
+                putchar(ch);
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar('%');
+                p++;
+                continue;
+            }
+
+            // Teilformat für die libc: Flags, Breite und Genauigkeit (* aufgelöst)
+            char spec[64];
+            size_t n = 0;
+            const char *q = p + 1;
+            spec[n++] = '%';
+            while (*q && strchr("-+ #0", *q) && n < 8)
+                spec[n++] = *q++;
+            if (*q == '*') {
+                n += (size_t)snprintf(spec + n, 24, "%d", (int)printf_int(*av, &status));
+                if (*av) av++;
+                q++;
+            } else {
+                while (isdigit((unsigned char)*q) && n < 24)
+                    spec[n++] = *q++;
+            }
+            if (*q == '.') {
+                spec[n++] = *q++;
+                if (*q == '*') {
+                    int prec = (int)printf_int(*av, &status);
+                    if (*av) av++;
+                    q++;
+                    if (prec >= 0) n += (size_t)snprintf(spec + n, 24, "%d", prec);
+                    else           n--;   // negativ = keine Genauigkeit
+                } else {
+                    while (isdigit((unsigned char)*q) && n < 48)
+                        spec[n++] = *q++;
+                }
+            }
+
+            char conv = *q;
+            const char *arg = *av;
+            if (conv && strchr("diouxXcsbeEfFgGaA", conv) && arg)
+                av++;
+            switch (conv) {
+            case 'd': case 'i':
+                memcpy(spec + n, "ll", 2);
+                spec[n + 2] = conv;
+                spec[n + 3] = '\0';
+                printf(spec, printf_int(arg, &status));
+                break;
+            case 'o': case 'u': case 'x': case 'X':
+                memcpy(spec + n, "ll", 2);
+                spec[n + 2] = conv;
+                spec[n + 3] = '\0';
+                printf(spec, (unsigned long long)printf_int(arg, &status));
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                spec[n] = conv;
+                spec[n + 1] = '\0';
+                printf(spec, printf_float(arg, &status));
+                break;
+            case 'c':
+                spec[n] = 'c';
+                spec[n + 1] = '\0';
+                if (arg && *arg)
+                    printf(spec, *arg);
+                break;
+            case 's':
+            case 'b': {
+                const char *s = arg ? arg : "";
+                int r = 0;
+                if (conv == 'b') {
+                    char *buf = arena_alloc(&g_line_arena, strlen(s) + 1);
+                    size_t len;
+                    r = unescape(s, buf, 1, &len);
+                    s = buf;
+                }
+                spec[n] = 's';
+                spec[n + 1] = '\0';
+                printf(spec, s);
+                if (r < 0)
+                    goto out;
+                break;
+            }
+            default:
+                fprintf(stderr, "printf: ungültige Umwandlung '%%%c'\n", conv ? conv : ' ');
+                status = 1;
+                goto out;
+            }
+            p = q;
+        }
+    } while (*av && av != pass);
+out:
+    if (builtin_out_status("printf"))
+        status = 1;
+    return status;
+}
+
+// test / [: POSIX-Ausdrücke mit !, -a, -o und Klammern.
+// Status 0 = wahr, 1 = falsch, 2 = Syntaxfehler.
+struct test_ctx {
+    const char *name;
+    char **av;
+    int n, pos;
+    int err;
+};
+
+static int test_binop(const char *s) {
+    static const char *const ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef", NULL
+    };
+    for (int i = 0; ops[i]; i++)
+        if (strcmp(s, ops[i]) == 0)
+            return 1;
+    return 0;
+}
+
+static int test_unop(const char *s) {
+    return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghkLnprsStuwxzOG", s[1]);
+}
+
+static void test_error(struct test_ctx *t, const char *msg, const char *arg) {
+    if (!t->err)
+        fprintf(stderr, "%s: %s%s%s\n", t->name, msg, arg ? ": " : "", arg ? arg : "");
+    t->err = 1;
+}
+
+static long long test_int(struct test_ctx *t, const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t')
+        end++;
+    if (end == s || *end != '\0' || errno != 0)
+        test_error(t, "ganze Zahl erwartet", s);
+    return v;
+}
+
+static int test_unary(struct test_ctx *t, char op, const char *s) {
+    struct stat st;
+    switch (op) {
+    case 'z': return s[0] == '\0';
+    case 'n': return s[0] != '\0';
+    case 't': return isatty((int)test_int(t, s));
+    case 'r': return access(s, R_OK) == 0;
+    case 'w': return access(s, W_OK) == 0;
+    case 'x': return access(s, X_OK) == 0;
+    case 'h':
+    case 'L': return lstat(s, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(s, &st) != 0)
+        return 0;
+    switch (op) {
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    }
+    return 0;
+}
+
+static int test_binary(struct test_ctx *t, const char *a, const char *op, const char *b) {
+    if (op[0] != '-') {
+        int c = strcmp(a, b);
+        if (op[0] == '<') return c < 0;
+        if (op[0] == '>') return c > 0;
+        return op[0] == '!' ? c != 0 : c == 0;
+    }
+    if ((op[1] == 'n' && op[2] == 't') || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')) {
+        struct stat sa, sb;
+        int ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+        if (op[1] == 'e')
+            return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        if (!ha || !hb)
+            return op[1] == 'n' ? ha && !hb : hb && !ha;
+        long long d = (long long)(sa.st_mtim.tv_sec - sb.st_mtim.tv_sec);
+        if (d == 0)
+            d = sa.st_mtim.tv_nsec - sb.st_mtim.tv_nsec;
+        return op[1] == 'n' ? d > 0 : d < 0;
+    }
+    long long x = test_int(t, a), y = test_int(t, b);
+    switch (op[1] << 8 | op[2]) {
+    case 'e' << 8 | 'q': return x == y;
+    case 'n' << 8 | 'e': return x != y;
+    case 'l' << 8 | 't': return x < y;
+    case 'l' << 8 | 'e': return x <= y;
+    case 'g' << 8 | 't': return x > y;
+    default:             return x >= y;   // -ge
+    }
+}
+
+static int test_or(struct test_ctx *t);
+
+static int test_primary(struct test_ctx *t) {
+    if (t->pos >= t->n) {
+        test_error(t, "Argument erwartet", NULL);
+        return 0;
+    }
+    char *a = t->av[t->pos];
+    // Binärer Operator hat Vorrang: "[ -n = x ]" vergleicht Strings
+    if (t->pos + 2 < t->n && test_binop(t->av[t->pos + 1])) {
+        t->pos += 3;
+        return test_binary(t, a, t->av[t->pos - 2], t->av[t->pos - 1]);
+    }
+    if (strcmp(a, "(") == 0 && t->pos + 1 < t->n) {
+        t->pos++;
+        int v = test_or(t);
+        if (t->pos >= t->n || strcmp(t->av[t->pos], ")") != 0)
+            test_error(t, "')' erwartet", NULL);
+        else
+            t->pos++;
+        return v;
+    }
+    if (test_unop(a) && t->pos + 1 < t->n) {
+        t->pos += 2;
+        return test_unary(t, a[1], t->av[t->pos - 1]);
+    }
+    t->pos++;
+    return a[0] != '\0';   // einzelner String: nicht leer
+}
+
+static int test_not(struct test_ctx *t) {
+    if (t->pos + 1 < t->n && strcmp(t->av[t->pos], "!") == 0 &&
+        !(t->pos + 2 < t->n && test_binop(t->av[t->pos + 1]))) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(struct test_ctx *t) {
+    int v = test_not(t);
+    while (t->pos < t->n && strcmp(t->av[t->pos], "-a") == 0) {
+        t->pos++;
+        int r = test_not(t);   // immer auswerten, damit Syntaxfehler auffallen
+        v = v && r;
+    }
+    return v;
+}
+
+static int test_or(struct test_ctx *t) {
+    int v = test_and(t);
+    while (t->pos < t->n && strcmp(t->av[t->pos], "-o") == 0) {
+        t->pos++;
+        int r = test_and(t);
+        v = v || r;
+    }
+    return v;
+}
+
+static int test_eval(const char *name, char **av, int n) {
+    if (n == 0)
+        return 1;
+    struct test_ctx t = { .name = name, .av = av, .n = n };
+    int v = test_or(&t);
+    if (!t.err && t.pos < t.n)
+        test_error(&t, "unerwartetes Argument", t.av[t.pos]);
+    return t.err ? 2 : !v;
+}
+
+static int builtin_test(char *args[]) {
+    int n = 0;
+    while (args[n + 1])
+        n++;
+    return test_eval("test", args + 1, n);
+}
+
+static int builtin_bracket(char *args[]) {
+    int n = 0;
+    while (args[n + 1])
+        n++;
+    if (n == 0 || strcmp(args[n], "]") != 0) {
+        fprintf(stderr, "[: ']' fehlt\n");
+        return 2;
+    }
+    return test_eval("[", args + 1, n - 1);
+}
+
+static int builtin_true(char *args[])  { (void)args; return 0; }
+static int builtin_false(char *args[]) { (void)args; return 1; }
+
+static int builtin_pwd(char *args[]) {
+    (void)args;
+    char cwd[512];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("pwd");
+        return 1;
+    }
+    printf("%s\n", cwd);
+    return builtin_out_status("pwd");
+}
+
+static int builtin_cd(char *args[]) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "cd: Pfad fehlt\n");
+        return 1;
+    }
+    if (chdir(args[1]) != 0) {
+        perror("cd");
+        return 1;
+    }
+    cwd_changed();
+    return 0;
+}
+
+// spawn            -> Start-Latenz je Engine
+// spawn fork|posix -> Engine umschalten, spawn reset -> Statistik löschen
+static int builtin_spawn(char *args[]) {
+    if (args[1] == NULL) {
+        printf("Engine: %s\n", spawn_engine_names[g_spawn_engine]);
+        for (int e = 0; e < SPAWN_ENGINES; e++) {
+            const struct spawn_stat *st = &g_spawn_stats[e];
+            if (st->count == 0) {
+                printf("  %-12s  0 Starts\n", spawn_engine_names[e]);
+                continue;
+            }
+            printf("  %-12s %lu Starts, avg %llu µs, min %llu µs, max %llu µs\n",
+                   spawn_engine_names[e], st->count,
+                   st->total_ns / st->count / 1000, st->min_ns / 1000, st->max_ns / 1000);
+        }
+    } else if (strcmp(args[1], "fork") == 0) {
+        g_spawn_engine = SPAWN_FORK;
+    } else if (strcmp(args[1], "posix") == 0) {
+        g_spawn_engine = SPAWN_POSIX;
+    } else if (strcmp(args[1], "reset") == 0) {
+        memset(g_spawn_stats, 0, sizeof(g_spawn_stats));
+    } else {
+        fprintf(stderr, "spawn: [fork|posix|reset]\n");
+        return 2;
+    }
+    return 0;
+}
+
+// pipesz [bytes] -> Pipe-Puffergröße für Pipelines anzeigen/setzen (0 = Default)
+static int builtin_pipesz(char *args[]) {
+    if (args[1] == NULL) {
+        if (g_pipe_size > 0) printf("Pipe-Puffer: %d Bytes\n", g_pipe_size);
+        else                 printf("Pipe-Puffer: Kernel-Default\n");
+        return 0;
+    }
+    char *end;
+    long v = strtol(args[1], &end, 0);
+    if (*end != '\0' || v < 0 || v > (1L << 30)) {
+        fprintf(stderr, "pipesz: ungültige Größe '%s'\n", args[1]);
+        return 1;
+    }
+    g_pipe_size = (int)v;
+    return 0;
+}
+
+// hash          -> Pfad-Cache mit Trefferzahlen
+// hash -r       -> Cache leeren, hash name... -> Namen vorab auflösen
+static int builtin_hash(char *args[]) {
+    int status = 0;
+    if (args[1] == NULL) {
+        int any = 0;
+        for (int i = 0; i < HASH_BUCKETS; i++) {
+            for (struct hash_entry *e = g_hash[i]; e; e = e->next) {
+                if (!any) printf("Treffer\tKommando\n");
+                printf("%7lu\t%s\n", e->hits, e->path);
+                any = 1;
+            }
+        }
+        if (!any) printf("hash: Cache ist leer\n");
+    } else if (strcmp(args[1], "-r") == 0) {
+        hash_clear();
+    } else {
+        for (int i = 1; args[i]; i++) {
+            int cached;
+            if (!path_lookup(args[i], &cached)) {
+                fprintf(stderr, "hash: %s: nicht gefunden\n", args[i]);
+                status = 1;
+            } else if (!cached) {
+                g_hash[hash_name(args[i])]->hits = 0;   // nur vorgemerkt, nicht benutzt
+            }
+        }
+    }
+    return status;
+}
+
+// jobs -> Jobtabelle anzeigen
+static int builtin_jobs(char *args[]) {
+    (void)args;
+    reap_children();
+    for (int i = 0; i < MAX_JOBS; i++) {
+        const struct job *j = &g_jobs[i];
+        // Fertige meldet jobs_notify (einmal, mit Status)
+        if (j->state == JOB_FREE || j->state == JOB_DONE) continue;
+        printf("[%d] %-8s  %s\n", j->id, job_state_name(j), j->cmd);
+    }
+    for (int k = 0; k < g_admit_n; k++)
+        printf("[Q%d] %-8s  %s\n", k + 1, "Wartend",
+               g_admit_q[(g_admit_head + k) % ADMIT_QUEUE_MAX].text);
+    jobs_notify();
+    return 0;
+}
+
+// fg [%n] -> Job in den Vordergrund holen (gestoppte werden fortgesetzt)
+static int builtin_fg(char *args[]) {
+    reap_children();
+    struct job *j = job_find_spec(args[1]);
+    if (!j) {
+        fprintf(stderr, "fg: kein solcher Job\n");
+        return 1;
+    }
+    printf("%s\n", j->cmd);
+    job_foreground(j, 1);
+    return g_last_status;
+}
+
+// bg [%n] -> gestoppten Job im Hintergrund fortsetzen
+static int builtin_bg(char *args[]) {
+    reap_children();
+    struct job *j = job_find_spec(args[1]);
+    if (!j) {
+        fprintf(stderr, "bg: kein solcher Job\n");
+        return 1;
+    }
+    j->background = 1;
+    if (j->state == JOB_STOPPED)
+        job_continue(j);
+    printf("[%d] %s &\n", j->id, j->cmd);
+    return 0;
+}
+
+// wait [%n|pid ...] -> auf bestimmte oder alle laufenden Hintergrundjobs warten
+static int builtin_wait(char *args[]) {
+    reap_children();
+    if (args[1] == NULL) {
+        admit_drain();
+        for (int i = 0; i < MAX_JOBS; i++) {
+            struct job *j = &g_jobs[i];
+            if (j->state == JOB_RUNNING || j->state == JOB_DONE) {
+                wait_for_job(j);
+                if (j->state == JOB_DONE) job_free(j);
+            }
+        }
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; args[i]; i++) {
+        struct job *j = job_find_spec(args[i]);
+        if (!j) {
+            fprintf(stderr, "wait: %s: kein solcher Job\n", args[i]);
+            status = 127;
+            continue;
+        }
+        wait_for_job(j);
+        status = g_last_status;
+        if (j->state == JOB_DONE) job_free(j);
+    }
+    return status;
+}
+
+// timing [on|off] -> Ressourcenbericht für jedes Kommando
+static int builtin_timing(char *args[]) {
+    if (args[1] == NULL)
+        printf("timing: %s\n", g_timing_always ? "on" : "off");
+    else if (strcmp(args[1], "on") == 0)
+        g_timing_always = 1;
+    else if (strcmp(args[1], "off") == 0)
+        g_timing_always = 0;
+    else {
+        fprintf(stderr, "timing: [on|off]\n");
+        return 2;
+    }
+    return 0;
+}
+
+// Eigene cgroup laut /proc/self/cgroup ("0::/pfad"), als Pfad unter cg2_root()
+static int jobcg_self(char *out, size_t size) {
+    FILE *f = fopen("/proc/self/cgroup", "re");
+    if (!f)
+        return -1;
+    char line[PATH_MAX];
+    int found = -1;
+    while (found != 0 && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) != 0)
+            continue;
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(out, size, "%s%s", cg2_root(), strcmp(line + 3, "/") == 0 ? "" : line + 3);
+        found = 0;
+    }
+    fclose(f);
+    return found;
+}
+
+// jobcg einschalten: Verzeichnis prüfen, memory-Controller für die Leafs
+// freischalten (geht nur, wenn dort selbst keine Prozesse liegen) und mit
+// einer Probe-Leaf testen, ob ein Kind wirklich beitreten darf
+static int jobcg_enable(const char *dir) {
+    char parent[PATH_MAX], path[PATH_MAX + 32];
+    if (!dir) {
+        if (jobcg_self(parent, sizeof(parent)) != 0) {
+            fprintf(stderr, "jobcg: keine cgroup v2 in /proc/self/cgroup\n");
+            return -1;
+        }
+    } else {
+        snprintf(parent, sizeof(parent), "%s%s%s", dir[0] == '/' ? "" : cg2_root(),
+                 dir[0] == '/' ? "" : "/", dir);
+    }
+
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", parent);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ssize_t w = write(fd, "+memory", 7);
+        (void)w;
+        close(fd);
+    }
+
+    snprintf(path, sizeof(path), "%s/minishell-%d-probe", parent, (int)getpid());
+    int err = mkdir(path, 0755) == 0 ? 0 : errno;
+    if (err == 0) {
+        char procs[sizeof(path) + 16];
+        snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(cgroup_join(procs));
+        int st;
+        if (pid < 0 || waitpid(pid, &st, 0) != pid)
+            err = errno;
+        else if (WIFEXITED(st))
+            err = WEXITSTATUS(st);
+        rmdir(path);
+    }
+    if (err) {
+        fprintf(stderr, "jobcg: %s: %s\n", parent, strerror(err));
+        return -1;
+    }
+
+    free(g_jobcg_parent);
+    g_jobcg_parent = strdup(parent);
+    return g_jobcg_parent ? 0 : -1;
+}
+
+// jobcg [on [dir]|off] -> eigene cgroup-v2-Leaf je Job; der Bericht (cpu.stat,
+// memory.peak) kommt mit time / timing on
+static int builtin_jobcg(char *args[]) {
+    if (args[1] == NULL) {
+        if (!g_jobcg_parent) {
+            printf("jobcg: off\n");
+            return 0;
+        }
+        char buf[256], path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/cgroup.subtree_control", g_jobcg_parent);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        ssize_t n = fd >= 0 ? read(fd, buf, sizeof(buf) - 1) : -1;
+        if (fd >= 0) close(fd);
+        buf[n > 0 ? n : 0] = '\0';
+        printf("jobcg: on (%s, memory.peak %s)\n", g_jobcg_parent,
+               strstr(buf, "memory") ? "ja" : "nein – memory-Controller nicht freigeschaltet");
+    } else if (strcmp(args[1], "on") == 0) {
+        return jobcg_enable(args[2]) == 0 ? 0 : 1;
+    } else if (strcmp(args[1], "off") == 0) {
+        free(g_jobcg_parent);
+        g_jobcg_parent = NULL;
+    } else {
+        fprintf(stderr, "jobcg: [on [dir]|off]\n");
+        return 2;
+    }
+    return 0;
+}
+
+// arena -> Speicherverbrauch der Zeilen-Arena
+static int builtin_arena(char *args[]) {
+    (void)args;
+    const struct arena *a = &g_line_arena;
+    printf("Arena: %zu Bytes in dieser Zeile, Hochwasser %zu Bytes\n", a->used, a->high_water);
+    printf("       %u Chunks, %zu Bytes reserviert, %lu Zeilen\n",
+           a->nchunks, a->reserved, a->resets);
+    return 0;
+}
+
+static int builtin_exit(char *args[]) {
+    // Batch: sofort beenden, optional mit eigenem Status
+    if (g_batch)
+        exit(args[1] ? atoi(args[1]) : g_last_status);
+    char ans[8];
+    printf("Shell wirklich beenden? (y/n): ");
+    fflush(stdout);
+    if (input_getline(ans, sizeof(ans)) && ans[0] == 'y') {
+        printf("Shell wird beendet.\n");
+        exit(0);
+    }
+    return g_last_status;
+}
+
+// Verlauf: Ring der letzten HIST_MAX Zeilen im Speicher. Jede Zeile hat eine
+// fortlaufende Nummer (seq); im Ring liegen die Nummern [seq - n, seq).
+// Persistenz: neue Zeilen sammeln sich in pend und werden erst geschrieben, wenn die
+// Shell ohnehin auf die nächste Taste wartet (O_APPEND, mehrere Shells vertragen sich);
+// fdatasync gebündelt nach HIST_SYNC_LINES Zeilen oder HIST_SYNC_MS.
+#define HIST_MAX        (1u << 17)
+#define HIST_SYNC_LINES 32
+#define HIST_SYNC_MS    5000
+struct history {
+    char **line;                   // HIST_MAX Plätze, Index seq % HIST_MAX
+    uint32_t seq, n;
+    int fd;                        // Verlaufsdatei oder -1
+    char *pend;                    // noch nicht geschriebene Zeilen
+    size_t pend_len, pend_cap;
+    unsigned unsynced;             // geschrieben, aber noch nicht fdatasync'd
+    unsigned long long sync_due;   // now_ns(), 0 = nichts offen
+};
+static struct history g_hist = { .fd = -1 };
+
+// Trigramm-Index für die Rückwärtssuche: je Bucket die aufsteigenden Nummern der
+// Zeilen, die ein Trigramm mit diesem Hash enthalten. Kollisionen und aus dem Ring
+// gefallene Nummern filtert der memmem-Vergleich bzw. die Untergrenze.
+#define TRI_BUCKETS (1u << 16)
+struct tri_list {
+    uint32_t *v;
+    uint32_t n, cap;
+};
+static struct tri_list *g_tri;
+
+static unsigned tri_hash(const char *p) {
+    uint32_t x = (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 |
+                 (unsigned char)p[2];
+    return (x * 2654435761u) >> 16;
+}
+
+static void tri_add(uint32_t seq, const char *s, size_t len) {
+    for (size_t i = 0; i + 3 <= len; i++) {
+        struct tri_list *l = &g_tri[tri_hash(s + i)];
+        if (l->n && l->v[l->n - 1] == seq)
+            continue;   // Trigramm kommt mehrfach in der Zeile vor
+        if (l->n == l->cap) {
+            uint32_t cap = l->cap ? l->cap * 2 : 8;
+            uint32_t *nv = realloc(l->v, cap * sizeof(*nv));
+            if (!nv)
+                return;
+            l->v = nv;
+            l->cap = cap;
+        }
+        l->v[l->n++] = seq;
+    }
+}
+
+// Index aus dem Ring neu aufbauen (verwirft verdrängte Nummern)
+static void tri_rebuild(void) {
+    for (unsigned b = 0; b < TRI_BUCKETS; b++)
+        g_tri[b].n = 0;
+    for (uint32_t s = g_hist.seq - g_hist.n; s != g_hist.seq; s++) {
+        const char *l = g_hist.line[s % HIST_MAX];
+        tri_add(s, l, strlen(l));
+    }
+}
+
+static int hist_init_mem(void) {
+    if (g_hist.line)
+        return 0;
+    g_hist.line = calloc(HIST_MAX, sizeof(*g_hist.line));
+    g_tri = calloc(TRI_BUCKETS, sizeof(*g_tri));
+    if (!g_hist.line || !g_tri) {
+        free(g_hist.line);
+        free(g_tri);
+        g_hist.line = NULL;
+        g_tri = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static const char *hist_get(uint32_t seq) {
+    return g_hist.line[seq % HIST_MAX];
+}
+
+// Zeile (len Bytes, nicht unbedingt terminiert) in Ring und Index aufnehmen;
+// direkte Wiederholungen nicht. Rückgabe 1, wenn aufgenommen.
+static int hist_add_mem(const char *s, size_t len) {
+    if (!g_hist.line || len == 0)
+        return 0;
+    if (g_hist.n) {
+        const char *prev = hist_get(g_hist.seq - 1);
+        if (strlen(prev) == len && memcmp(prev, s, len) == 0)
+            return 0;
+    }
+    char *copy = malloc(len + 1);
+    if (!copy)
+        return 0;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    char **slot = &g_hist.line[g_hist.seq % HIST_MAX];
+    free(*slot);
+    *slot = copy;
+    g_hist.seq++;
+    if (g_hist.n < HIST_MAX)
+        g_hist.n++;
+    else if (g_hist.seq % HIST_MAX == 0)
+        tri_rebuild();   // nach jedem vollen Umlauf: höchstens doppelt so viele Einträge
+    tri_add(g_hist.seq - 1, copy, len);
+    return 1;
+}
+
+// Jüngste Zeile mit Nummer <= from, die q enthält; -1 wenn keine.
+// Ab drei Zeichen werden nur die Kandidaten des seltensten Trigramms geprüft.
+static long hist_search(const char *q, size_t qlen, long from) {
+    if (!g_hist.line || g_hist.n == 0 || from < 0)
+        return -1;
+    long oldest = (long)(g_hist.seq - g_hist.n);
+    if (from >= (long)g_hist.seq)
+        from = (long)g_hist.seq - 1;
+    if (qlen < 3) {
+        for (long s = from; s >= oldest; s--) {
+            const char *l = hist_get((uint32_t)s);
+            if (memmem(l, strlen(l), q, qlen))
+                return s;
+        }
+        return -1;
+    }
+    const struct tri_list *best = NULL;
+    for (size_t i = 0; i + 3 <= qlen; i++) {
+        const struct tri_list *l = &g_tri[tri_hash(q + i)];
+        if (!best || l->n < best->n)
+            best = l;
+    }
+    // größter Eintrag <= from
+    uint32_t lo = 0, hi = best->n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((long)best->v[mid] <= from) lo = mid + 1;
+        else                            hi = mid;
+    }
+    while (lo-- > 0 && (long)best->v[lo] >= oldest) {
+        const char *l = hist_get(best->v[lo]);
+        if (memmem(l, strlen(l), q, qlen))
+            return best->v[lo];
+    }
+    return -1;
+}
+
+// Offene Zeilen schreiben; sync: auch fdatasync, sonst nur wenn fällig
+static void hist_flush(int sync) {
+    if (g_hist.fd < 0)
+        return;
+    // Sperre nur gegen das Kürzen durch eine startende Shell (hist_compact)
+    if (g_hist.pend_len)
+        flock(g_hist.fd, LOCK_EX);
+    size_t off = 0;
+    while (off < g_hist.pend_len) {
+        ssize_t w = write(g_hist.fd, g_hist.pend + off, g_hist.pend_len - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Verlauf: %s\n", strerror(errno));
+            close(g_hist.fd);
+            g_hist.fd = -1;
+            return;
+        }
+        off += (size_t)w;
+    }
+    if (g_hist.pend_len)
+        flock(g_hist.fd, LOCK_UN);
+    g_hist.pend_len = 0;
+    if (g_hist.unsynced == 0)
+        return;
+    if (sync || g_hist.unsynced >= HIST_SYNC_LINES || now_ns() >= g_hist.sync_due) {
+        fdatasync(g_hist.fd);
+        g_hist.unsynced = 0;
+        g_hist.sync_due = 0;
+    }
+}
+
+static void hist_flush_atexit(void) {
+    hist_flush(1);
+}
+
+// Neue Eingabezeile: in den Speicher und (verzögert) in die Datei
+static void hist_add(const char *s) {
+    size_t len = strlen(s);
+    if (!hist_add_mem(s, len) || g_hist.fd < 0)
+        return;
+    if (g_hist.pend_len + len + 1 > g_hist.pend_cap) {
+        size_t cap = g_hist.pend_cap ? g_hist.pend_cap : 4096;
+        while (cap < g_hist.pend_len + len + 1)
+            cap *= 2;
+        char *np = realloc(g_hist.pend, cap);
+        if (!np)
+            return;
+        g_hist.pend = np;
+        g_hist.pend_cap = cap;
+    }
+    memcpy(g_hist.pend + g_hist.pend_len, s, len);
+    g_hist.pend[g_hist.pend_len + len] = '\n';
+    g_hist.pend_len += len + 1;
+    if (g_hist.unsynced++ == 0)
+        g_hist.sync_due = now_ns() + HIST_SYNC_MS * 1000000ull;
+}
+
+// Datei ab Offset start nach vorn schieben und kürzen. In place unter flock statt
+// temporäre Datei + rename: andere Shells schreiben über ihr offenes O_APPEND-fd
+// weiter in dieselbe Datei (nach einem rename landeten ihre Zeilen in der alten).
+// Seit dem Laden angehängte Zeilen bleiben erhalten.
+static void hist_compact(int fd, off_t start) {
+    int fl = fcntl(fd, F_GETFL);
+    if (fl < 0 || flock(fd, LOCK_EX) != 0)
+        return;
+    struct stat st;
+    char *buf = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > start &&
+        fcntl(fd, F_SETFL, fl & ~O_APPEND) == 0) {   // pwrite ignoriert sonst den Offset
+        size_t len = (size_t)(st.st_size - start);
+        if ((buf = malloc(len)) && pread(fd, buf, len, start) == (ssize_t)len &&
+            pwrite(fd, buf, len, 0) == (ssize_t)len)
+            if (ftruncate(fd, (off_t)len) == 0)
+                fdatasync(fd);
+        fcntl(fd, F_SETFL, fl);
+    }
+    free(buf);
+    flock(fd, LOCK_UN);
+}
+
+// Verlaufsdatei: MINISHELL_HISTFILE (leer = keine), sonst ~/.minishell_history.
+// Die letzten HIST_MAX Zeilen werden geladen; ist die Datei auf mehr als das Doppelte
+// gewachsen, wird sie auf diese Zeilen gekürzt (hist_compact).
+static void hist_open(void) {
+    if (hist_init_mem() != 0)
+        return;
+    const char *path = getenv("MINISHELL_HISTFILE");
+    char buf[PATH_MAX];
+    if (!path) {
+        const char *home = getenv("HOME");
+        if (!home || snprintf(buf, sizeof(buf), "%s/.minishell_history", home) >= (int)sizeof(buf))
+            return;
+        path = buf;
+    }
+    if (!*path)
+        return;
+
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Verlauf: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+        // von hinten den Anfang der letzten HIST_MAX Zeilen suchen
+        size_t end = (size_t)st.st_size, start = end;
+        if (start > 0 && map[start - 1] == '\n')
+            start--;
+        for (unsigned lines = 0; start > 0; start--)
+            if (map[start - 1] == '\n' && ++lines == HIST_MAX)
+                break;
+        for (const char *l = map + start, *e; l < map + end; l = e + 1) {
+            e = memchr(l, '\n', (size_t)(map + end - l));
+            if (!e)
+                e = map + end;
+            hist_add_mem(l, (size_t)(e - l));
+        }
+
+        munmap(map, (size_t)st.st_size);
+        // Mehr verworfen als behalten: Datei auf den behaltenen Teil kürzen
+        if (start > end - start)
+            hist_compact(fd, (off_t)start);
+    }
+    g_hist.fd = fd;
+    atexit(hist_flush_atexit);
+}
+
+// history [n]  -> die letzten n (alle) Zeilen mit Nummer
+// history -c   -> Verlauf im Speicher leeren (die Datei bleibt)
+static int builtin_history(char *args[]) {
+    if (!g_hist.line)
+        return 0;
+    if (args[1] && strcmp(args[1], "-c") == 0) {
+        // Im Kind (mit & oder in einer Pipeline) ginge das Leeren verloren
+        if (g_stage_child) {
+            fprintf(stderr, "history -c: nur in der Shell selbst (nicht mit & oder |)\n");
+            return 1;
+        }
+        for (uint32_t i = 0; i < HIST_MAX; i++) {
+            free(g_hist.line[i]);
+            g_hist.line[i] = NULL;
+        }
+        g_hist.n = 0;
+        tri_rebuild();
+        return 0;
+    }
+    uint32_t n = g_hist.n;
+    if (args[1]) {
+        char *end;
+        long v = strtol(args[1], &end, 10);
+        if (*end != '\0' || v < 0) {
+            fprintf(stderr, "history: [n | -c]\n");
+            return 2;
+        }
+        if ((unsigned long)v < n)
+            n = (uint32_t)v;
+    }
+    for (uint32_t s = g_hist.seq - n; s != g_hist.seq; s++)
+        printf("%6u  %s\n", s + 1, hist_get(s));
+    return builtin_out_status("history");
+}
+
+#define TRACE_NAME(n) #n,
+static const char *const trace_names[TR_COUNT] = { TRACE_EVENTS(TRACE_NAME) };
+#undef TRACE_NAME
+
+// trace            -> Zustand und Anzahl der Einträge
+// trace on|off     -> Aufzeichnung in den Ring ein/aus (die USDT-Probes sind immer da)
+// trace dump [n]   -> die letzten n (alle) Einträge: Zeit seit dem ersten, Abstand zum
+//                     vorigen, Ereignis, Text, Zahl
+// trace clear      -> Ring leeren
+static int builtin_trace(char *args[]) {
+    uint32_t have = g_trace_n < TRACE_RING ? g_trace_n : TRACE_RING;
+    if (args[1] == NULL) {
+        printf("trace: %s, %u Einträge (%u insgesamt), USDT %s\n", g_trace_on ? "on" : "off",
+               have, g_trace_n,
+#ifdef HAVE_SDT
+               "ja"
+#else
+               "nein (ohne <sys/sdt.h> gebaut)"
+#endif
+               );
+    } else if (strcmp(args[1], "on") == 0) {
+        g_trace_on = 1;
+    } else if (strcmp(args[1], "off") == 0) {
+        g_trace_on = 0;
+    } else if (strcmp(args[1], "clear") == 0) {
+        g_trace_n = 0;
+    } else if (strcmp(args[1], "dump") == 0) {
+        uint32_t n = have;
+        if (args[2]) {
+            long v = strtol(args[2], NULL, 10);
+            if (v >= 0 && (uint32_t)v < n)
+                n = (uint32_t)v;
+        }
+        // der Dump selbst soll nicht im Ring landen
+        int on = g_trace_on;
+        g_trace_on = 0;
+        uint32_t first = g_trace_n - n;
+        uint64_t t0 = n ? g_trace[first % TRACE_RING].ns : 0, prev = t0;
+        for (uint32_t i = first; i != g_trace_n; i++) {
+            const struct trace_rec *r = &g_trace[i % TRACE_RING];
+            printf("%12.3f ms %+10.1f µs  %-13s %-21s %ld\n", (double)(r->ns - t0) / 1e6,
+                   (double)(r->ns - prev) / 1e3, trace_names[r->ev], r->text, r->arg);
+            prev = r->ns;
+        }
+        g_trace_on = on;
+    } else {
+        fprintf(stderr, "trace: [on|off|dump [n]|clear]\n");
+        return 2;
+    }
+    return builtin_out_status("trace");
+}
+
+// Built-In-Tabelle, nach Namen sortiert (strcmp-Reihenfolge) für bsearch
+static const struct builtin g_builtins[] = {
+    { "[",        builtin_bracket,  1 },
+    { "admit",    builtin_admit,    0 },
+    { "arena",    builtin_arena,    0 },
+    { "bg",       builtin_bg,       0 },
+    { "cat",      builtin_cat,      1 },   // nur wenn cat_builtin_ok; in der Shell nur cat_in_shell
+    { "cd",       builtin_cd,       0 },
+    { "cpuhist",  builtin_cpuhist,  0 },
+    { "echo",     builtin_echo,     1 },
+    { "exit",     builtin_exit,     0 },
+    { "false",    builtin_false,    1 },
+    { "fg",       builtin_fg,       0 },
+    { "hash",     builtin_hash,     0 },
+    { "history",  builtin_history,  1 },
+    { "jobcg",    builtin_jobcg,    0 },
+    { "jobs",     builtin_jobs,     0 },
+    { "parallel", builtin_parallel, 0 },
+    { "pipesz",   builtin_pipesz,   0 },
+    { "printf",   builtin_printf,   1 },
+    { "pwd",      builtin_pwd,      1 },
+    { "spawn",    builtin_spawn,    0 },
+    { "test",     builtin_test,     1 },
+    { "timing",   builtin_timing,   0 },
+    { "trace",    builtin_trace,    0 },
+    { "true",     builtin_true,     1 },
+    { "wait",     builtin_wait,     0 },
+};
+#define NBUILTINS (sizeof(g_builtins) / sizeof(g_builtins[0]))
+
+static int builtin_cmp(const void *key, const void *elem) {
+    return strcmp(key, ((const struct builtin *)elem)->name);
+}
+
+static const struct builtin *builtin_find(const char *name) {
+    return bsearch(name, g_builtins, NBUILTINS, sizeof(g_builtins[0]), builtin_cmp);
+}
+
+static const struct builtin *builtin_for(const struct command *cmd) {
+    const struct builtin *b = builtin_find(cmd->argv[0]);
+    if (b && b->fn == builtin_cat && !cat_builtin_ok(cmd))
+        return NULL;
+    return b;
+}
+
+static int is_builtin(const struct command *cmd) {
+    return builtin_for(cmd) != NULL;
+}
+
+// Built-In, das statt exec im geforkten Kind laufen kann, sonst NULL
+static builtin_fn *builtin_stage(const struct command *cmd) {
+    const struct builtin *b = builtin_for(cmd);
+    return b && b->stage ? b->fn : NULL;
+}
+
+// Prozess starten (Foreground / Background)
+void run_process(struct command *cmd, int background, int pl_timed, const char *cmdline) {
+    char **args = cmd->argv;
+    TRACE(process, cmdline, background);
+    struct job *j = job_alloc(cmdline, 1, background);
+    if (!j)
+        return;
+
+    struct fd_map *maps;
+    int nmaps;
+    if (redirs_open(cmd, &maps, &nmaps) != 0) {
+        job_free(j);
+        g_last_status = 1;
+        return;
+    }
+
+    jobcg_create(j);
+    char procs[PATH_MAX];
+    if (j->cg)
+        snprintf(procs, sizeof(procs), "%s/cgroup.procs", j->cg);
+
+    struct spawn_opts o = {
+        .in_fd = -1, .out_fd = -1,
+        .maps = maps, .nmaps = nmaps,
+        .pgid = j->pgid, .foreground = !background,
+        .sched = cmd->sched,
+        .builtin = builtin_stage(cmd),
+        .cgroup_procs = j->cg ? procs : NULL,
+    };
+    pid_t pid = spawn_cmd(args, &o);
+    redirs_close(maps, nmaps);
+    if (pid < 0) {
+        job_free(j);
+        g_last_status = 127;
+        return;
+    }
+    job_add_proc(j, pid);
+
+    j->timed |= pl_timed;
+
+    if (g_batch)
+        ;   // keine Statusmeldung
+    else if (background)
+        printf("[PID %d] gestartet (Hintergrund, Job %d) (%s, %llu µs)\n", pid, j->id,
+               spawn_engine_names[g_last_spawn_engine], g_last_spawn_ns / 1000);
+    else
+        printf("[PID %d] gestartet (%s, %llu µs)\n", pid,
+               spawn_engine_names[g_last_spawn_engine], g_last_spawn_ns / 1000);
+
+    if (!background)
+        job_foreground(j, 0);
+}
+
+// Pipeline mit beliebig vielen Stufen (cmd1 | cmd2 | ... | cmdN).
+// Alle Pipes werden vorab angelegt, alle Stufen gleichzeitig gestartet
+// und als ein Job (eine Prozessgruppe) gemeinsam eingesammelt.
+void run_pipe(struct pipeline *pl) {
+    int nstages = pl->ncmds;
+    int background = pl->background;
+    int npipes = nstages - 1;
+    int *fds = arena_alloc(&g_line_arena, (size_t)(2 * npipes) * sizeof(*fds));
+    TRACE(pipe_begin, pl->text, nstages);
+
+    struct job *j = job_alloc(pl->text, nstages, background);
+    if (!j)
+        return;
+    j->timed |= pl->timed;
+
+    for (int i = 0; i < npipes; i++) {
+        if (pipe(&fds[2 * i]) == -1) {
+            perror("pipe");
+            for (int k = 0; k < 2 * i; k++)
+                close(fds[k]);
+            job_free(j);
+            return;
+        }
+        if (g_pipe_size > 0 &&
+            fcntl(fds[2 * i + 1], F_SETPIPE_SZ, g_pipe_size) == -1 && i == 0)
+            perror("F_SETPIPE_SZ");
+    }
+
+    // Alle Stufen in eine gemeinsame Leaf-cgroup (jobcg)
+    jobcg_create(j);
+    char procs[PATH_MAX];
+    if (j->cg)
+        snprintf(procs, sizeof(procs), "%s/cgroup.procs", j->cg);
+
+    // Stufe i liest aus Pipe i-1 und schreibt in Pipe i;
+    // eigene Umlenkungen einer Stufe haben Vorrang vor der Pipe
+    for (int i = 0; i < nstages; i++) {
+        struct fd_map *maps;
+        int nmaps;
+        if (redirs_open(&pl->cmds[i], &maps, &nmaps) != 0)
+            continue;
+        struct spawn_opts o = {
+            .in_fd  = (i > 0)      ? fds[2 * (i - 1)] : -1,
+            .out_fd = (i < npipes) ? fds[2 * i + 1]   : -1,
+            .close_fds = fds, .nclose = 2 * npipes,
+            .maps = maps, .nmaps = nmaps,
+            .pgid = j->pgid, .foreground = !background,
+            .sched = pl->cmds[i].sched,
+            .builtin = builtin_stage(&pl->cmds[i]),
+            .cgroup_procs = j->cg ? procs : NULL,
+        };
+        pid_t pid = spawn_cmd(pl->cmds[i].argv, &o);
+        redirs_close(maps, nmaps);
+        if (pid >= 0)
+            job_add_proc(j, pid);
+    }
+
+    // Elternprozess
+    for (int i = 0; i < 2 * npipes; i++)
+        close(fds[i]);
+    TRACE(pipe_end, pl->text, j->nprocs);
+
+    if (j->nprocs == 0) {
+        job_free(j);
+        g_last_status = 127;
+        return;
+    }
+
+    if (!g_batch) {
+        printf("[Pipe] %d/%d Prozesse gestartet:", j->nprocs, nstages);
+        for (int i = 0; i < j->nprocs; i++)
+            printf(" %d", j->procs[i].pid);
+        if (background)
+            printf(" (Hintergrund, Job %d)", j->id);
+        printf(" (%s)\n", spawn_engine_names[g_last_spawn_engine]);
+    }
+
+    if (!background)
+        job_foreground(j, 0);
+}
+
+// Führt eine Pipeline aus (Built-In, einzelnes Kommando oder mehrere Stufen)
+static void execute_pipeline(struct pipeline *pl) {
+    // "&" bei hoher Last: zurückhalten statt starten
+    if (pl->background && admit_enqueue(pl))
+        return;
+
+    if (pl->ncmds > 1) {
+        run_pipe(pl);
+        return;
+    }
+
+    // Built-In-Befehle; Umlenkungen gelten dann für die Shell selbst.
+    // Zustandslose Built-Ins mit & oder Präfixen laufen wie Programme als Kind,
+    // cat außerdem bei Eingabe, die nicht aus regulären Dateien kommt.
+    struct command *cmd = &pl->cmds[0];
+    int as_child = builtin_stage(cmd) &&
+                   (pl->background || cmd->sched ||
+                    (builtin_stage(cmd) == builtin_cat && !cat_in_shell(cmd)));
+    if (is_builtin(cmd) && !as_child) {
+        if (cmd->sched)
+            fprintf(stderr, "%s: Präfixe gelten nicht für Built-Ins\n", cmd->argv[0]);
+        struct fd_map *maps;
+        int nmaps;
+        if (redirs_open(cmd, &maps, &nmaps) != 0) {
+            g_last_status = 1;
+            return;
+        }
+        int saved[nmaps + 1];
+        int timed = pl->timed || g_timing_always;
+        struct rusage ru0, ru1;
+        unsigned long long t0 = now_ns();
+        if (timed) getrusage(RUSAGE_SELF, &ru0);
+
+        redirs_apply_shell(maps, nmaps, saved);
+        run_builtin(cmd->argv);
+        redirs_restore_shell(maps, nmaps, saved);
+        redirs_close(maps, nmaps);
+
+        // Built-In läuft in der Shell: Differenz der eigenen rusage
+        if (timed) {
+            getrusage(RUSAGE_SELF, &ru1);
+            timersub(&ru1.ru_utime, &ru0.ru_utime, &ru1.ru_utime);
+            timersub(&ru1.ru_stime, &ru0.ru_stime, &ru1.ru_stime);
+            ru1.ru_nvcsw  -= ru0.ru_nvcsw;
+            ru1.ru_nivcsw -= ru0.ru_nivcsw;
+            ru1.ru_majflt -= ru0.ru_majflt;
+            ru1.ru_minflt -= ru0.ru_minflt;
+            print_rusage("time", (double)(now_ns() - t0) / 1e9, &ru1);
+        }
+        return;
+    }
+
+    // Externes Programm starten
+    run_process(&pl->cmds[0], pl->background, pl->timed, pl->text);
+}
+
+// $? in einem Wort einsetzen (Kopie in der Arena, sonst das Wort selbst)
+static char *expand_status_word(char *w, struct arena *a) {
+    if (!strchr(w, STATUS_MARK))
+        return w;
+    char num[12];
+    int nlen = snprintf(num, sizeof(num), "%d", g_last_status);
+    size_t marks = 0;
+    for (const char *p = w; (p = strchr(p, STATUS_MARK)); p++)
+        marks++;
+    char *out = arena_alloc(a, strlen(w) - marks + marks * (size_t)nlen + 1);
+    char *o = out;
+    for (const char *p = w; *p; p++) {
+        if (*p == STATUS_MARK) {
+            memcpy(o, num, (size_t)nlen);
+            o += nlen;
+        } else {
+            *o++ = *p;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+
+static void expand_status(struct pipeline *pl, struct arena *a) {
+    if (!pl->has_status)
+        return;
+    for (int c = 0; c < pl->ncmds; c++) {
+        struct command *cmd = &pl->cmds[c];
+        for (int i = 0; i < cmd->argc; i++)
+            cmd->argv[i] = expand_status_word(cmd->argv[i], a);
+        for (struct redir *r = cmd->redirs; r; r = r->next)
+            r->target = expand_status_word(r->target, a);
+    }
+}
+
+// Kommandoliste einer Zeile direkt ausführen (ohne Subshell): && bzw. || prüfen den
+// Status der zuletzt ausgeführten Pipeline, übersprungene lassen ihn stehen.
+// Ein per Strg+C abgebrochenes Kommando beendet die ganze Liste.
+static void execute_list(struct pipeline *pl) {
+    for (; pl; pl = pl->next) {
+        if ((pl->op == LIST_AND && g_last_status != 0) ||
+            (pl->op == LIST_OR && g_last_status == 0))
+            continue;
+        expand_status(pl, &g_line_arena);
+        unsigned sigint0 = g_sigint_count;
+        if (pl->background)
+            g_last_status = 0;   // wie POSIX: $? nach "cmd &" ist 0
+        execute_pipeline(pl);
+        if (g_last_status == 128 + SIGINT || g_sigint_count != sigint0)
+            break;
+    }
+}
+
+// Prompt
+// PS1-artige Vorlage, beim Start einmal in Segmente zerlegt.
+//   \w Verzeichnis  \W letzte Komponente  \L CPU-Last  \u Benutzer  \h Host
+//   \$ '#' für root, sonst '$'  \n \e \a \\  (\[ \] werden ignoriert)
+// Benutzer, Host und \$ ändern sich nicht und werden schon beim Zerlegen eingesetzt.
+// Das Ergebnis wird zwischengespeichert und nur neu gebaut, wenn sich das Verzeichnis
+// (cd) oder der Lastdatensatz (Zeitstempel) geändert hat.
+#define PROMPT_DEFAULT  "\\w [\\L]> "
+#define PROMPT_MAX_SEGS 32
+
+enum prompt_kind { PS_LIT, PS_CWD, PS_CWD_BASE, PS_LOAD };
+struct prompt_seg {
+    enum prompt_kind kind;
+    char *text;               // nur PS_LIT
+    size_t len;
+};
+static struct prompt_seg g_ps[PROMPT_MAX_SEGS];
+static int g_ps_n = 0;
+static int g_ps_uses_load = 0;
+
+static char g_prompt[PATH_MAX + 512];
+static size_t g_prompt_len = 0;
+static int g_prompt_valid = 0;        // 0 = beim nächsten Mal neu bauen
+static uint64_t g_prompt_load_key = 0;
+
+static void prompt_add(enum prompt_kind kind, const char *text, size_t len) {
+    if (g_ps_n == PROMPT_MAX_SEGS || (kind == PS_LIT && len == 0))
+        return;
+    struct prompt_seg *sg = &g_ps[g_ps_n++];
+    sg->kind = kind;
+    sg->text = kind == PS_LIT ? strndup(text, len) : NULL;
+    sg->len = sg->text ? len : 0;
+    if (kind == PS_LOAD) g_ps_uses_load = 1;
+}
+
+static void prompt_parse(const char *tmpl) {
+    char lit[1024];
+    size_t n = 0;
+    char host[256];
+    for (const char *p = tmpl; *p; p++) {
+        const char *add = NULL;
+        char ch[2] = { *p, '\0' };
+        enum prompt_kind dyn = PS_LIT;
+        if (*p != '\\' || !p[1]) {
+            add = ch;
+        } else {
+            switch (*++p) {
+                case 'w': dyn = PS_CWD; break;
+                case 'W': dyn = PS_CWD_BASE; break;
+                case 'L': dyn = PS_LOAD; break;
+                case 'u': {
+                    struct passwd *pw = getpwuid(getuid());
+                    add = pw ? pw->pw_name : "?";
+                    break;
+                }
+                case 'h':
+                    if (gethostname(host, sizeof(host)) != 0) strcpy(host, "?");
+                    host[sizeof(host) - 1] = '\0';
+                    host[strcspn(host, ".")] = '\0';
+                    add = host;
+                    break;
+                case '$': add = geteuid() == 0 ? "#" : "$"; break;
+                case 'n': add = "\n"; break;
+                case 'e': add = "\033"; break;
+                case 'a': add = "\a"; break;
+                case '\\': add = "\\"; break;
+                case '[': case ']': add = ""; break;
+                default:  // unbekannt: wörtlich übernehmen
+                    if (n < sizeof(lit)) lit[n++] = '\\';
+                    ch[0] = *p;
+                    add = ch;
+                    break;
+            }
+        }
+        if (dyn != PS_LIT) {
+            prompt_add(PS_LIT, lit, n);
+            n = 0;
+            prompt_add(dyn, NULL, 0);
+            continue;
+        }
+        size_t len = strlen(add);
+        if (n + len > sizeof(lit)) len = sizeof(lit) - n;
+        memcpy(lit + n, add, len);
+        n += len;
+    }
+    prompt_add(PS_LIT, lit, n);
+}
+
+// Arbeitsverzeichnis für den Prompt; ändert sich nur über cd
+static char g_cwd[PATH_MAX];
+static int g_cwd_ok = 0;
+
+// PWD übernehmen, wenn es wirklich auf "." zeigt (behält Symlink-Pfade), sonst getcwd
+static void cwd_init(void) {
+    const char *pwd = getenv("PWD");
+    struct stat a, b;
+    if (pwd && pwd[0] == '/' && strlen(pwd) < sizeof(g_cwd) &&
+        stat(pwd, &a) == 0 && stat(".", &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+        strcpy(g_cwd, pwd);
+        g_cwd_ok = 1;
+    } else {
+        g_cwd_ok = getcwd(g_cwd, sizeof(g_cwd)) != NULL;
+        if (g_cwd_ok) setenv("PWD", g_cwd, 1);
+    }
+    g_prompt_valid = 0;
+}
+
+// nach erfolgreichem chdir: PWD/OLDPWD nachführen, Prompt neu bauen
+static void cwd_changed(void) {
+    if (g_cwd_ok) setenv("OLDPWD", g_cwd, 1);
+    g_cwd_ok = getcwd(g_cwd, sizeof(g_cwd)) != NULL;
+    if (g_cwd_ok) setenv("PWD", g_cwd, 1);
+    else unsetenv("PWD");
+    g_prompt_valid = 0;
+}
+
+static void prompt_render(const struct cpuload_sample *smp) {
+    size_t n = 0, cap = sizeof(g_prompt);
+    for (int i = 0; i < g_ps_n && n < cap; i++) {
+        const struct prompt_seg *sg = &g_ps[i];
+        const char *src = sg->text;
+        size_t len = sg->len;
+        switch (sg->kind) {
+            case PS_LIT:
+                break;
+            case PS_CWD:
+                src = g_cwd_ok ? g_cwd : "sh";
+                len = strlen(src);
+                break;
+            case PS_CWD_BASE: {
+                const char *slash = strrchr(g_cwd, '/');
+                src = !g_cwd_ok ? "sh" : (slash && slash[1]) ? slash + 1 : g_cwd;
+                len = strlen(src);
+                break;
+            }
+            case PS_LOAD:
+                n += cpu_prompt_format(smp, g_prompt + n, cap - n);
+                continue;
+        }
+        if (len > cap - n) len = cap - n;
+        memcpy(g_prompt + n, src, len);
+        n += len;
+    }
+    g_prompt_len = n;
+}
+
+// Prompt ausgeben: aus dem Cache, wenn sich weder Verzeichnis noch Lastdatensatz geändert
+// haben, in jedem Fall mit einem einzigen write()
+static void prompt_print(void) {
+    struct cpuload_sample smp;
+    int have = -1;
+    uint64_t key = 0;
+    if (g_ps_uses_load) {
+        have = cpu_sample_now(&smp);
+        key = have < 0 ? 0 : smp.timestamp_ns;
+    }
+    if (!g_prompt_valid || key != g_prompt_load_key) {
+        prompt_render(have < 0 ? NULL : &smp);
+        g_prompt_load_key = key;
+        g_prompt_valid = 1;
+    }
+    fflush(stdout);   // z.B. Jobmeldungen vor dem Prompt
+    for (size_t off = 0; off < g_prompt_len;) {
+        ssize_t w = write(STDOUT_FILENO, g_prompt + off, g_prompt_len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        off += (size_t)w;
+    }
+}
+
+// Prompt nach einer Meldung erneut zeigen (unverändert aus dem Cache)
+static void prompt_redraw(void) {
+    if (!g_prompt_valid)
+        prompt_print();
+    else {
+        fflush(stdout);
+        if (write(STDOUT_FILENO, g_prompt, g_prompt_len) < 0) { /* egal */ }
+    }
+    ed_refresh();   // Eingabezeile des Editors wiederherstellen
+}
+
+// Zeileneditor (nur wenn stdin und stdout Terminals sind): Rohmodus ohne ICANON/ECHO,
+// ISIG bleibt an (Strg+C/Strg+Z gehen weiter über signalfd). Eine Zeile, horizontal
+// gescrollt; jede Aktualisierung ist ein einziges write().
+//   Pfeile, Strg+A/E/B/F, Pos1/Ende  Cursor      Strg+P/N, Pfeil hoch/runter  Verlauf
+//   Backspace, Entf, Strg+D/K/U/W    Löschen     Strg+L  Bildschirm löschen
+//   Strg+R  Rückwärtssuche (Strg+R weiter, Enter ausführen, Strg+G abbrechen)
+struct editor {
+    int active;
+    char *buf;                // Zeile (gehört dem Aufrufer, wächst bei Bedarf)
+    size_t len, cap, pos;     // pos: Byte-Offset des Cursors
+    uint32_t hist;            // angezeigte Verlaufsnummer, g_hist.seq = eigene Zeile
+    char *saved;              // eigene Zeile, während im Verlauf geblättert wird
+    int searching;
+    char query[256];
+    size_t qlen;
+    long match;               // Treffer der Suche oder -1
+    int failed;               // letzte Suche ohne Treffer (match bleibt stehen)
+    unsigned sigint0;
+};
+static struct editor g_ed;
+static struct termios g_ed_raw;
+static int g_ed_enabled = 0;
+
+static int ed_enable(void) {
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+        return 0;
+    const char *term = getenv("TERM");
+    if (term && strcmp(term, "dumb") == 0)
+        return 0;
+    g_ed_raw = g_shell_tmodes;
+    g_ed_raw.c_lflag &= ~(unsigned)(ICANON | ECHO | IEXTEN);
+    g_ed_raw.c_iflag &= ~(unsigned)(ICRNL | IXON | INPCK | ISTRIP);
+    g_ed_raw.c_cc[VMIN] = 1;
+    g_ed_raw.c_cc[VTIME] = 0;
+    return 1;
+}
+
+// Sichtbare Spalten: UTF-8-Folgebytes und Escape-Sequenzen (CSI, OSC) zählen nicht
+static size_t ed_width(const char *s, size_t len) {
+    size_t w = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == 033 && i + 1 < len && s[i + 1] == '[') {
+            for (i += 2; i < len && !((unsigned char)s[i] >= 0x40 && (unsigned char)s[i] <= 0x7e); i++)
+                ;
+        } else if (c == 033 && i + 1 < len && s[i + 1] == ']') {
+            for (i += 2; i < len && s[i] != '\a'; i++)
+                ;
+        } else if ((c & 0xc0) != 0x80 && c >= 0x20) {
+            w++;
+        }
+    }
+    return w;
+}
+
+// Byte-Offset nach cols sichtbaren Spalten ab s[from]
+static size_t ed_advance(const char *s, size_t len, size_t from, size_t cols) {
+    size_t i = from;
+    while (i < len && cols > 0) {
+        i++;
+        while (i < len && ((unsigned char)s[i] & 0xc0) == 0x80)
+            i++;
+        cols--;
+    }
+    return i;
+}
+
+static int ed_cols(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        return ws.ws_col;
+    return 80;
+}
+
+// Ausgabepuffer einer Aktualisierung
+struct ed_out {
+    char *p;
+    size_t n, cap;
+};
+
+static void ed_put(struct ed_out *o, const char *s, size_t len) {
+    if (o->n + len > o->cap) {
+        size_t cap = o->cap ? o->cap : 256;
+        while (cap < o->n + len)
+            cap *= 2;
+        char *np = realloc(o->p, cap);
+        if (!np)
+            return;
+        o->p = np;
+        o->cap = cap;
+    }
+    memcpy(o->p + o->n, s, len);
+    o->n += len;
+}
+
+static void ed_puts(struct ed_out *o, const char *s) {
+    ed_put(o, s, strlen(s));
+}
+
+static void ed_write(struct ed_out *o) {
+    for (size_t off = 0; off < o->n;) {
+        ssize_t w = write(STDOUT_FILENO, o->p + off, o->n - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        off += (size_t)w;
+    }
+    o->n = 0;
+}
+
+// Letzte Zeile des Prompts und Eingabezeile neu zeichnen
+static void ed_refresh(void) {
+    static struct ed_out o;
+    if (!g_ed.active)
+        return;
+    size_t cols = (size_t)ed_cols();
+    const char *pl = g_prompt;
+    for (const char *nl; (nl = memchr(pl, '\n', g_prompt_len - (size_t)(pl - g_prompt)));)
+        pl = nl + 1;
+    size_t pl_len = g_prompt_len - (size_t)(pl - g_prompt);
+
+    ed_puts(&o, "\r");
+    if (g_ed.searching) {
+        // (suche)'query': Treffer, auf die Breite gekürzt
+        ed_puts(&o, g_ed.failed ? "(suche, nichts)'" : "(suche)'");
+        ed_put(&o, g_ed.query, g_ed.qlen);
+        ed_puts(&o, "': ");
+        size_t used = ed_width(o.p + 1, o.n - 1);
+        if (g_ed.match >= 0 && used + 1 < cols) {
+            const char *m = hist_get((uint32_t)g_ed.match);
+            size_t mlen = strlen(m);
+            ed_put(&o, m, ed_advance(m, mlen, 0, cols - used - 1));
+        }
+        ed_puts(&o, "\x1b[K");
+        ed_write(&o);
+        return;
+    }
+
+    // Horizontal scrollen, sodass der Cursor sichtbar bleibt
+    size_t pw = ed_width(pl, pl_len);
+    size_t avail = cols > pw + 10 ? cols - pw - 1 : 10;
+    size_t ccol = ed_width(g_ed.buf, g_ed.pos);
+    size_t first = ccol >= avail ? ccol - avail + 1 : 0;
+    size_t b0 = ed_advance(g_ed.buf, g_ed.len, 0, first);
+    size_t b1 = ed_advance(g_ed.buf, g_ed.len, b0, avail);
+    ed_put(&o, pl, pl_len);
+    ed_put(&o, g_ed.buf + b0, b1 - b0);
+    char mv[32];
+    snprintf(mv, sizeof(mv), "\x1b[K\r\x1b[%zuC", pw + ccol - first);
+    ed_puts(&o, pw + ccol - first ? mv : "\x1b[K\r");
+    ed_write(&o);
+}
+
+static int ed_reserve(size_t need) {
+    if (need + 1 <= g_ed.cap)
+        return 0;
+    size_t cap = g_ed.cap ? g_ed.cap : 256;
+    while (cap < need + 1)
+        cap *= 2;
+    char *nb = realloc(g_ed.buf, cap);
+    if (!nb)
+        return -1;
+    g_ed.buf = nb;
+    g_ed.cap = cap;
+    return 0;
+}
+
+static void ed_set(const char *s) {
+    size_t len = strlen(s);
+    if (ed_reserve(len) != 0)
+        return;
+    memcpy(g_ed.buf, s, len + 1);
+    g_ed.len = g_ed.pos = len;
+}
+
+static void ed_insert(const char *s, size_t n) {
+    if (ed_reserve(g_ed.len + n) != 0)
+        return;
+    memmove(g_ed.buf + g_ed.pos + n, g_ed.buf + g_ed.pos, g_ed.len - g_ed.pos + 1);
+    memcpy(g_ed.buf + g_ed.pos, s, n);
+    g_ed.len += n;
+    g_ed.pos += n;
+}
+
+static void ed_delete(size_t from, size_t to) {
+    memmove(g_ed.buf + from, g_ed.buf + to, g_ed.len - to + 1);
+    g_ed.len -= to - from;
+    g_ed.pos = from;
+}
+
+static size_t ed_prev(size_t i) {
+    while (i > 0 && ((unsigned char)g_ed.buf[--i] & 0xc0) == 0x80)
+        ;
+    return i;
+}
+
+static size_t ed_next(size_t i) {
+    return ed_advance(g_ed.buf, g_ed.len, i, 1);
+}
+
+// Im Verlauf blättern: dir -1 älter, +1 neuer
+static void ed_history(int dir) {
+    uint32_t oldest = g_hist.seq - g_hist.n;
+    if (dir < 0 && g_ed.hist == oldest)
+        return;
+    if (dir > 0 && g_ed.hist == g_hist.seq)
+        return;
+    if (g_ed.hist == g_hist.seq) {
+        free(g_ed.saved);
+        g_ed.saved = strdup(g_ed.buf);
+    }
+    g_ed.hist += (uint32_t)dir;
+    ed_set(g_ed.hist == g_hist.seq ? (g_ed.saved ? g_ed.saved : "") : hist_get(g_ed.hist));
+}
+
+// Nächste Taste (Byte). Ist nichts gepuffert, werden zuerst offene Verlaufszeilen
+// geschrieben; timeout_ms < 0 wartet beliebig lange. Rückgabe -1 bei EOF/Fehler,
+// -2 bei Zeitablauf, -3 nach SIGINT.
+static int ed_getc(int timeout_ms) {
+    while (g_inpos == g_inlen) {
+        if (g_sigint_count != g_ed.sigint0)
+            return -3;   // Strg+C: Zeile verwerfen
+        hist_flush(0);
+        int t = timeout_ms;
+        if (t < 0 && g_hist.sync_due) {
+            unsigned long long now = now_ns();
+            t = g_hist.sync_due > now ? (int)((g_hist.sync_due - now) / 1000000) + 1 : 0;
+        }
+        unsigned long long t0 = now_ns();
+        if (!event_wait(1, t)) {
+            if (timeout_ms >= 0 && now_ns() - t0 >= (unsigned long long)timeout_ms * 1000000)
+                return -2;
+            continue;
+        }
+        ssize_t n = read(STDIN_FILENO, g_inbuf, sizeof(g_inbuf));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0)
+            return -1;
+        g_in = g_inbuf;
+        g_inlen = (size_t)n;
+        g_inpos = 0;
+    }
+    return (unsigned char)g_in[g_inpos++];
+}
+
+// Escape-Folge nach ESC in eine Taste übersetzen ('A'..'D' Pfeile, 'H'/'F' Pos1/Ende,
+// '3' Entf); 0 = unbekannt oder ESC allein
+static int ed_escape(void) {
+    int c = ed_getc(50);
+    if (c != '[' && c != 'O')
+        return 0;
+    int d = ed_getc(50);
+    if (d >= '0' && d <= '9') {
+        // CSI mit Parametern bis zum Endbyte lesen: "3~", "1~", "1;5C" (Strg+Pfeil) ...
+        int p1 = 0, e = d;
+        while (e >= '0' && e <= '9') {
+            if (p1 < 1000) p1 = p1 * 10 + (e - '0');
+            e = ed_getc(50);
+        }
+        while (e >= 0x20 && e <= 0x3f)   // weitere Parameter (";5") überspringen
+            e = ed_getc(50);
+        if (e == '~') {
+            if (p1 == 1 || p1 == 7) return 'H';
+            if (p1 == 4 || p1 == 8) return 'F';
+            return p1 == 3 ? '3' : 0;
+        }
+        d = e;   // "1;<mod>X": mit Modifier wie die Taste X selbst
+    }
+    return d == 'A' || d == 'B' || d == 'C' || d == 'D' || d == 'H' || d == 'F' ? d : 0;
+}
+
+// Rückwärtssuche ab Nummer from; ohne Treffer bleibt der bisherige stehen
+static void ed_search(long from) {
+    long m = g_ed.qlen ? hist_search(g_ed.query, g_ed.qlen, from) : -1;
+    g_ed.failed = g_ed.qlen && m < 0;
+    if (m >= 0 || !g_ed.qlen)
+        g_ed.match = m;
+}
+
+// Suche verlassen; accept: Treffer in die Zeile übernehmen
+static void ed_search_end(int accept) {
+    g_ed.searching = 0;
+    if (accept && g_ed.match >= 0) {
+        g_ed.hist = (uint32_t)g_ed.match;
+        ed_set(hist_get(g_ed.hist));
+        const char *hit = memmem(g_ed.buf, g_ed.len, g_ed.query, g_ed.qlen);
+        if (hit)
+            g_ed.pos = (size_t)(hit - g_ed.buf);
+    }
+}
+
+// Taste im Suchmodus; Rückgabe 1, wenn sie danach noch normal verarbeitet werden soll
+static int ed_search_key(int c) {
+    switch (c) {
+    case 0x12:   // Strg+R: nächster älterer Treffer
+        ed_search(g_ed.match >= 0 ? g_ed.match - 1 : (long)g_hist.seq - 1);
+        return 0;
+    case 0x07:   // Strg+G: abbrechen, Zeile wie vorher
+        ed_search_end(0);
+        return 0;
+    case 0x7f:
+    case 0x08:
+        if (g_ed.qlen > 0) {
+            while (g_ed.qlen > 0 && ((unsigned char)g_ed.query[--g_ed.qlen] & 0xc0) == 0x80)
+                ;
+            ed_search((long)g_hist.seq - 1);
+        }
+        return 0;
+    }
+    if (c >= 0x20 && c != 0x7f) {
+        if (g_ed.qlen + 1 < sizeof(g_ed.query)) {
+            g_ed.query[g_ed.qlen++] = (char)c;
+            // der bisherige Treffer passt evtl. noch
+            ed_search(g_ed.match >= 0 ? g_ed.match : (long)g_hist.seq - 1);
+        }
+        return 0;
+    }
+    ed_search_end(1);
+    return c != 033;   // ESC übernimmt nur
+}
+
+// Liest eine Zeile mit dem Editor nach *buf (wie input_readline, ohne '\n').
+// Rückgabe 0 bei EOF.
+static int ed_readline(char **buf, size_t *cap) {
+    g_ed = (struct editor){ .active = 1, .buf = *buf, .cap = *cap, .hist = g_hist.seq,
+                            .match = -1, .sigint0 = g_sigint_count };
+    if (ed_reserve(0) != 0)
+        return 0;
+    g_ed.buf[0] = '\0';
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &g_ed_raw);
+
+    int ret = 1;
+    for (;;) {
+        int c = ed_getc(-1);
+        if (c == -1) {   // EOF/Fehler
+            ret = g_ed.len > 0;
+            break;
+        }
+        if (c == -3) {   // Strg+C (signalfd): Zeile verwerfen, Prompt steht schon da
+            g_ed.sigint0 = g_sigint_count;
+            g_ed.searching = 0;
+            ed_set("");
+            g_ed.hist = g_hist.seq;
+            ed_refresh();
+            continue;
+        }
+        if (c == 033)
+            c = -ed_escape();   // Escape-Folgen als negative Tasten
+        if (g_ed.searching && !ed_search_key(c < 0 ? 033 : c) && c >= 0) {
+            ed_refresh();
+            continue;
+        }
+        if (c == '\r' || c == '\n') {
+            ed_refresh();   // nach einer Suche die übernommene Zeile zeigen
+            break;
+        }
+        switch (c) {
+        case 0x01: case -'H':            g_ed.pos = 0; break;                       // Strg+A
+        case 0x05: case -'F':            g_ed.pos = g_ed.len; break;                // Strg+E
+        case 0x02: case -'D':            g_ed.pos = ed_prev(g_ed.pos); break;       // Strg+B
+        case 0x06: case -'C':            g_ed.pos = ed_next(g_ed.pos); break;       // Strg+F
+        case 0x10: case -'A':            ed_history(-1); break;                     // Strg+P
+        case 0x0e: case -'B':            ed_history(+1); break;                     // Strg+N
+        case 0x7f: case 0x08:
+            if (g_ed.pos > 0)
+                ed_delete(ed_prev(g_ed.pos), g_ed.pos);
+            break;
+        case 0x04:                                                                  // Strg+D
+            if (g_ed.len == 0) {
+                ret = 0;
+                goto out;
+            }
+            /* fallthrough */
+        case -'3':
+            if (g_ed.pos < g_ed.len)
+                ed_delete(g_ed.pos, ed_next(g_ed.pos));
+            break;
+        case 0x0b:                                                                  // Strg+K
+            g_ed.buf[g_ed.len = g_ed.pos] = '\0';
+            break;
+        case 0x15:                                                                  // Strg+U
+            ed_delete(0, g_ed.pos);
+            break;
+        case 0x17: {                                                                // Strg+W
+            size_t p = g_ed.pos;
+            while (p > 0 && g_ed.buf[p - 1] == ' ') p--;
+            while (p > 0 && g_ed.buf[p - 1] != ' ') p--;
+            ed_delete(p, g_ed.pos);
+            break;
+        }
+        case 0x0c:                                                                  // Strg+L
+            if (write(STDOUT_FILENO, "\x1b[H\x1b[2J", 7) < 0) { /* egal */ }
+            if (write(STDOUT_FILENO, g_prompt, g_prompt_len) < 0) { /* egal */ }
+            break;
+        case 0x12:                                                                  // Strg+R
+            g_ed.searching = 1;
+            g_ed.qlen = 0;
+            g_ed.match = -1;
+            g_ed.failed = 0;
+            break;
+        default:
+            if (c >= 0x20) {
+                // alles bereits Gelesene bis zur nächsten Steuertaste auf einmal
+                // einfügen (Einfügen großer Textblöcke)
+                size_t n = 1;
+                while (g_inpos + n - 1 < g_inlen) {
+                    unsigned char d = (unsigned char)g_in[g_inpos + n - 1];
+                    if (d < 0x20 || d == 0x7f)
+                        break;
+                    n++;
+                }
+                char ch = (char)c;
+                ed_insert(&ch, 1);
+                ed_insert(g_in + g_inpos, n - 1);
+                g_inpos += n - 1;
+            }
+            break;
+        }
+        if (g_inpos == g_inlen)
+            ed_refresh();   // erst zeichnen, wenn keine weiteren Tasten anstehen
+    }
+out:
+    if (write(STDOUT_FILENO, "\r\n", 2) < 0) { /* egal */ }
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &g_shell_tmodes);
+    // Schon gelesene Tasten gehen an input_getline (z.B. exit-Rückfrage): wie ICRNL
+    for (size_t i = g_inpos; i < g_inlen; i++)
+        if (g_inbuf[i] == '\r')
+            g_inbuf[i] = '\n';
+    g_ed.active = 0;
+    free(g_ed.saved);
+    g_ed.saved = NULL;
+    *buf = g_ed.buf;
+    *cap = g_ed.cap;
+    if (ret && g_ed.len > 0)
+        hist_add(g_ed.buf);
+    return ret;
+}
+
+// Hauptprogramm
+int main(int argc, char *argv[]) {
+    // Batch-Modus: ./shell -c 'cmd', ./shell script.sh oder Eingabe aus Pipe/Datei
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Aufruf: %s [-c Kommando | Skript]\n", argv[0]);
+            return 2;
+        }
+        input_from_memory(argv[2], strlen(argv[2]));
+        g_batch = 1;
+    } else if (argc > 1) {
+        if (input_from_file(argv[1]) != 0)
+            return 127;
+        g_batch = 1;
+    } else {
+        g_batch = !isatty(STDIN_FILENO);
+    }
+
+    job_control_init();
+    cwd_init();
+
+    // Signalbehandlung aktivieren: SIGINT/SIGTSTP/SIGTERM/SIGCONT und SIGCHLD
+    // kommen über signalfd in die Event-Loop
+    if (event_loop_init() != 0)
+        return 1;
+
+    // Ring für "trace" schon ab dem Start füllen (MINISHELL_TRACE=1)
+    const char *env_trace = getenv("MINISHELL_TRACE");
+    if (env_trace && *env_trace && strcmp(env_trace, "0") != 0)
+        g_trace_on = 1;
+
+    // Leaf-cgroup je Job von Anfang an (MINISHELL_JOBCG=1 oder =<verzeichnis>)
+    const char *env_jobcg = getenv("MINISHELL_JOBCG");
+    if (env_jobcg && *env_jobcg && strcmp(env_jobcg, "0") != 0)
+        jobcg_enable(strcmp(env_jobcg, "1") == 0 ? NULL : env_jobcg);
+
+    // Spawn-Engine per Umgebung wählbar (MINISHELL_SPAWN=fork)
+    const char *env_spawn = getenv("MINISHELL_SPAWN");
+    if (env_spawn && strcmp(env_spawn, "fork") == 0)
+        g_spawn_engine = SPAWN_FORK;
+
+    // CPU-Last: bevorzugt Shared Memory, sonst Abonnement auf dem Socket; die MQ
+    // (jede Nachricht erreicht nur einen Leser) nur, wenn beides nicht geht.
+    // Nur interaktiv; ohne Prompt wird der Wert nicht gebraucht.
+    if (!g_batch) {
+        const char *ps1 = getenv("PS1");
+        prompt_parse(ps1 && *ps1 ? ps1 : PROMPT_DEFAULT);
+        if (cpu_shm_attach() != 0) {
+            g_cpu_shm_retry = time(NULL) + 5;
+            if (cpu_sock_open() == 0 && cpu_sock_request(CPULOAD_SOCK_SUBSCRIBE) != 0)
+                g_cpu_sub_retry = time(NULL) + 5;
+        }
+        if (!g_cpu_shm && (g_cpu_sock < 0 || g_cpu_sub_retry != 0))
+            mq_start_if_available();
+        // Zeileneditor und Verlauf nur mit Terminal und Job-Control
+        if (g_interactive && ed_enable()) {
+            g_ed_enabled = 1;
+            hist_open();
+        }
+    }
+
+    char *line = NULL;            // wächst bei Bedarf, wird nie verkleinert
+    size_t line_cap = 0;
+
+    if (!g_batch)
+        printf("Willkommen in der Mini-Shell (mit Signals, Background & Pipes)\n");
+
+    while (1) {
+        // Fertige Hintergrundjobs melden, zurückgehaltene ggf. starten
+        jobs_notify();
+        if (g_admit_n > 0)
+            admit_dispatch();
+
+        int got;
+        if (g_batch) {
+            got = input_readline(&line, &line_cap);
+        } else {
+            prompt_print();
+
+            g_at_prompt = 1;
+            got = g_ed_enabled ? ed_readline(&line, &line_cap) : input_readline(&line, &line_cap);
+            g_at_prompt = 0;
+        }
+        if (!got)
+            break;
+        trim_newline(line);
+
+        if (line[0] == '\0')
+            continue;
+
+        // Alles, was für diese Zeile entsteht, liegt in der Arena
+        arena_reset(&g_line_arena);
+        char *cmdline = arena_strdup(&g_line_arena, line);   // Originaltext für die Jobtabelle
+
+        struct pipeline *pl = parse_command(line, cmdline, &g_line_arena);
+        if (!pl)
+            continue;
+        execute_list(pl);
+    }
+
+    // Batch: zurückgehaltene Hintergrundjobs noch starten
+    if (g_batch)
+        admit_drain();
 
     // Sauber aufräumen, falls REPL verlassen wurde (EOF/ Fehler)
     mq_stop_and_close();
+    cpu_sock_close();
+    cpu_shm_detach();
+    free(line);
 
+    if (g_batch)
+        return g_last_status;
     printf("Shell beendet.\n");
     return 0;
 }
\ No newline at end of file